@@ -78,8 +78,24 @@
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
-#define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_FCYC      0 /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_ITIMER    0 /* interval timer (any Unix box) */
+#define USE_GETTOD    0 /* gettimeofday (any Unix box) */
+#define USE_MONOTONIC 1 /* clock_gettime(CLOCK_MONOTONIC_RAW) w/stats (Linux) */
+
+/*
+ * Parameters of the USE_MONOTONIC timer: untimed warmup runs, timed
+ * runs (the median is reported, along with the mean, standard deviation
+ * and 95% confidence interval), and whether to pin the runs to one CPU
+ */
+#ifndef MONO_WARMUP
+#define MONO_WARMUP 2
+#endif
+#ifndef MONO_REPS
+#define MONO_REPS   11
+#endif
+#ifndef MONO_PIN
+#define MONO_PIN    1
+#endif
 
 #endif /* __CONFIG_H */
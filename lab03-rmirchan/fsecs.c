@@ -9,6 +9,7 @@
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static ftimer_stats_t last_stats; /* runs of the last fsecs call */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +37,11 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_MONOTONIC
+    if (verbose)
+	printf("Measuring performance with CLOCK_MONOTONIC_RAW: median of "
+	       "%d runs after %d warmup runs%s.\n", MONO_REPS, MONO_WARMUP,
+	       MONO_PIN ? ", pinned to one CPU" : "");
 #endif
 }
 
@@ -51,7 +57,25 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_MONOTONIC
+    return ftimer_monotonic(f, argp, MONO_WARMUP, MONO_REPS, MONO_PIN,
+			    &last_stats);
 #endif 
 }
 
+/*
+ * fsecs_stats - Copy out the statistics of the last fsecs call, if the
+ * timer keeps any
+ */
+int fsecs_stats(ftimer_stats_t *stats)
+{
+#if USE_MONOTONIC
+    *stats = last_stats;
+    return 1;
+#else
+    (void)last_stats;
+    return 0;
+#endif
+}
+
 
@@ -1,4 +1,10 @@
+#include "ftimer.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* With USE_MONOTONIC, the statistics of the last fsecs call; returns 0
+   (and leaves *stats alone) with the other timers */
+int fsecs_stats(ftimer_stats_t *stats);
@@ -7,9 +7,15 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_monotonic: version that uses clock_gettime, with statistics
  */
+#define _GNU_SOURCE     /* for sched_getcpu and sched_setaffinity */
+#include <math.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include "ftimer.h"
 
 /* function prototypes */
@@ -52,6 +58,78 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/* two-sided 95% Student t values for 1..30 degrees of freedom */
+static const double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * ftimer_monotonic - Use CLOCK_MONOTONIC_RAW, which neither NTP nor
+ * frequency scaling adjusts, to time n runs of f(argp) after warmup
+ * untimed ones. With pin set, all of them run on the CPU we are on now,
+ * so a migration can't land in the middle of a run. Return the median
+ * run time and fill in *stats if it is not NULL.
+ */
+double ftimer_monotonic(ftimer_test_funct f, void *argp, int warmup, int n,
+			int pin, ftimer_stats_t *stats)
+{
+    struct timespec t0, t1;
+    cpu_set_t old, one;
+    double *runs, sum = 0, sq = 0, median;
+    int i, cpu;
+
+    if (n < 1)
+	n = 1;
+    if ((runs = malloc(n * sizeof(*runs))) == NULL) {
+	fprintf(stderr, "malloc failed in ftimer_monotonic\n");
+	exit(1);
+    }
+
+    if (pin && (cpu = sched_getcpu()) >= 0 &&
+	sched_getaffinity(0, sizeof(old), &old) == 0) {
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	sched_setaffinity(0, sizeof(one), &one);
+    } else {
+	pin = 0;
+    }
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (i = 0; i < n; i++) {
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+	f(argp);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+	runs[i] = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+	sum += runs[i];
+    }
+
+    if (pin)
+	sched_setaffinity(0, sizeof(old), &old);
+
+    qsort(runs, n, sizeof(*runs), cmp_double);
+    median = (n % 2) ? runs[n / 2] : (runs[n / 2 - 1] + runs[n / 2]) / 2;
+    if (stats != NULL) {
+	stats->n = n;
+	stats->mean = sum / n;
+	stats->median = median;
+	for (i = 0; i < n; i++)
+	    sq += (runs[i] - stats->mean) * (runs[i] - stats->mean);
+	stats->stddev = (n > 1) ? sqrt(sq / (n - 1)) : 0;
+	stats->ci95 = (n > 1) ? (n - 1 <= 30 ? t95[n - 2] : 1.96) *
+	    stats->stddev / sqrt(n) : 0;
+    }
+    free(runs);
+    return median;
+}
 
 /*
  * Routines for manipulating the Unix interval timer
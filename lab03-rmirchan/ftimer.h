@@ -1,3 +1,6 @@
+#ifndef __FTIMER_H_
+#define __FTIMER_H_
+
 /* 
  * Function timers 
  */
@@ -12,3 +15,22 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+
+
+/* Summary of the runs timed by ftimer_monotonic, all in seconds */
+typedef struct {
+    int n;          /* timed runs, after the warmup */
+    double mean;
+    double median;
+    double stddev;  /* sample standard deviation */
+    double ci95;    /* half-width of the 95% confidence interval of the mean */
+} ftimer_stats_t;
+
+/* Estimate the running time of f(argp) using clock_gettime
+   (CLOCK_MONOTONIC_RAW): run it warmup times untimed, then time n runs
+   one by one, optionally pinned to the current CPU. Return the median
+   and fill in *stats if it is not NULL */
+double ftimer_monotonic(ftimer_test_funct f, void *argp, int warmup, int n,
+			int pin, ftimer_stats_t *stats);
+
+#endif /* __FTIMER_H_ */
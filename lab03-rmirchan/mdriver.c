@@ -7,6 +7,7 @@
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
@@ -18,6 +19,14 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #ifndef __GCC__
 #  define __attribute__(args)
@@ -28,6 +37,8 @@
 #include "fsecs.h"
 #include "config.h"
 #include "driverlib.h"
+#include "tracefmt.h"
+#include "perfctr.h"
 
 /**********************
  * Constants and macros
@@ -60,12 +71,7 @@ typedef struct range_t {
 	int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-	enum { ALLOC, FREE, REALLOC } type; /* type of request */
-	int index;                        /* index for free() to use later */
-	size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
+/* A single trace operation (traceop_t) is defined in tracefmt.h */
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -75,6 +81,8 @@ typedef struct {
 	int num_ops;         /* number of distinct requests */
 	int weight;          /* weight for this trace (unused) */
 	traceop_t *ops;      /* array of requests */
+	void *map;           /* mapping of a binary trace that ops points into */
+	size_t map_len;      /* length of that mapping */
 	char **blocks;       /* array of ptrs returned by malloc/realloc... */
 	size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 	int *block_rand_base;/* index into random_data, if debug is on */
@@ -90,6 +98,38 @@ typedef struct {
 	range_t *ranges;
 } speed_t;
 
+#ifdef MM_THREADS
+/* Holds the params to one thread of the multithreaded trace replayer */
+typedef struct {
+	trace_t *trace;
+	int reps;                   /* how many times to run the trace */
+	char **blocks;              /* this thread's own block pointers */
+	pthread_barrier_t *start;   /* all threads begin the trace together */
+	struct timespec t0, t1;     /* when this thread started and finished */
+	double ops;                 /* mm calls made, including cleanup */
+	int failed;                 /* set if the heap ran out of memory */
+} replay_t;
+
+/* Each replay thread runs its trace until it has made this many calls */
+#define REPLAY_MIN_OPS 200000
+#endif
+
+/*
+ * Per-call latencies of one trace, in cycles, for each request type.
+ * The histogram buckets are log scale with LAT_SUB buckets per power of
+ * two (see lat_bucket), which bounds the error of a percentile to a
+ * quarter of its value whatever the range of latencies.
+ */
+#define LAT_SUB_BITS 2
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  (64 * LAT_SUB)
+
+typedef struct {
+	unsigned long count[3][LAT_BUCKETS]; /* indexed by ALLOC/FREE/REALLOC */
+	unsigned long n[3];                  /* calls of each type */
+	unsigned long max[3];                /* slowest call of each type */
+} latency_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
 	/* set in read_trace */
@@ -100,9 +140,18 @@ typedef struct {
 	/* run-time stats defined for both libc and student */
 	int valid;       /* was the trace processed correctly by the allocator? */
 	double secs;     /* number of secs needed to run the trace */
+	int timed;       /* is timing filled in? (only some timers keep it) */
+	ftimer_stats_t timing; /* the runs that secs was taken from */
+	int counted;     /* are events filled in? (only with -C) */
+	double events[PERF_NEVENTS]; /* hardware events of one run, or -1 */
+	double huge_secs; /* secs again with a huge page heap (-L), or 0 */
 
 	/* defined only for the student malloc package */
 	double util;     /* space utilization for this trace (always 0 for libc) */
+	double peak;     /* most bytes of heap + mappings held at once */
+	double final;    /* bytes of heap + mappings held at the end */
+	latency_t *lat;  /* per-call latencies, only with -p */
+	mm_profile_t *prof; /* heap shape at the end of the trace, with -P */
 
 	/* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -135,6 +184,30 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* time every call and report latency percentiles (-p), and optionally
+   write the histograms to a CSV file (-H) */
+static int latency_flag = 0;
+static char *latency_csv = NULL;
+
+/* sample mm_profile every this many requests of the utilization run
+   (-P), and write the samples to a CSV file (-O) */
+static int profile_every = 0;
+static FILE *profile_csv = NULL;
+
+/* count hardware events over one more run of each trace (-C) */
+static int counters_flag = 0;
+
+/* time the traces again with the heap on these pages (-L) */
+static int huge_pages = MEM_PAGES_SMALL;
+
+/* check traces in this many worker processes at once (-j) */
+static int jobs = 1;
+
+#ifdef MM_THREADS
+/* replay every trace on up to this many threads (-T); 0 means don't */
+static int max_threads = 0;
+#endif
+
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -165,6 +238,9 @@ static void randomize_block(trace_t *trace, int index);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
 		const char *filename);
+static void check_trace_header(trace_t *trace);
+static void read_rep_trace(trace_t *trace, FILE *tracefile);
+static void read_bin_trace(trace_t *trace, int fd);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
@@ -175,11 +251,25 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, latency_t *lat);
+#ifdef MM_THREADS
+static double eval_mm_threads(trace_t *trace, int nthreads, double *ops);
+static void run_thread_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles);
+#endif
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printfootprint(int n, stats_t *stats);
+static void printtiming(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printhuge(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printprofile(int n, stats_t *stats);
+static void sample_profile(const trace_t *trace, int opnum, mm_profile_t *prof);
+static void writelatency(int n, stats_t *stats, const char *filename);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
 	__attribute__((format(printf, 3,4)));
@@ -228,17 +318,212 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 		if (mm_stats[i].valid) {
 			if (verbose > 1)
 				printf("efficiency, ");
-			mm_stats[i].util = eval_mm_util(trace, i);
+			mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
 			speed_params->trace = trace;
 			speed_params->ranges = ranges;
 			if (verbose > 1)
 				printf("and performance.\n");
 			mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+			mm_stats[i].timed = fsecs_stats(&mm_stats[i].timing);
+			if (counters_flag)
+				mm_stats[i].counted = perf_count(eval_mm_speed, speed_params,
+						mm_stats[i].events);
+			if (latency_flag) {
+				if ((mm_stats[i].lat = calloc(1, sizeof(latency_t))) == NULL)
+					unix_error("calloc failed in run_tests");
+				eval_mm_latency(trace, mm_stats[i].lat);
+			}
 		}
 		free_trace(trace);
 	}
 }
 
+/*
+ * Result of the correctness and utilization passes over one trace, as
+ * a worker process sends it back to the driver
+ */
+typedef struct {
+	stats_t stats;         /* lat and prof are not valid here... */
+	mm_profile_t prof;     /* ... the profile is sent here instead */
+	int errors;            /* errors the worker found */
+} result_t;
+
+/*
+ * check_trace - the body of one worker: check the trace for correctness
+ *     and measure its utilization on this process's own copy of the
+ *     heap, and write the result to fd.
+ */
+static void check_trace(int fd, const char *tracedir, const char *tracefile)
+{
+	result_t r;
+	range_t *ranges = NULL;
+	trace_t *trace;
+
+	memset(&r, 0, sizeof(r));
+	trace = read_trace(&r.stats, tracedir, tracefile);
+	r.stats.valid = eval_mm_valid(trace, &ranges);
+	if (r.stats.valid) {
+		r.stats.util = eval_mm_util(trace, 0, &r.stats);
+		if (r.stats.prof != NULL)
+			r.prof = *r.stats.prof;
+	}
+	r.stats.lat = NULL;
+	r.stats.prof = NULL;
+	r.errors = errors;
+	if (write(fd, &r, sizeof(r)) != sizeof(r))
+		unix_error("write failed in check_trace");
+	free_trace(trace);
+}
+
+/*
+ * run_tests_parallel - the -j version of run_tests. Every trace is
+ *    checked for correctness and utilization in a worker process of
+ *    its own (fork gives each one a private copy of the memlib heap),
+ *    with up to jobs of them running at once. Then the valid traces are
+ *    timed one after another, with the driver pinned to a single core.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+		char **tracefiles, stats_t *mm_stats, speed_t *speed_params)
+{
+	pid_t *pids;
+	int *fds;
+	int i, next = 0, running = 0, status;
+	cpu_set_t allowed, one;
+	result_t r;
+
+	if ((pids = calloc(num_tracefiles, sizeof(*pids))) == NULL ||
+			(fds = calloc(num_tracefiles, sizeof(*fds))) == NULL)
+		unix_error("calloc failed in run_tests_parallel");
+	if (verbose > 1)
+		printf("Checking %d traces for correctness and efficiency "
+				"in %d workers.\n", num_tracefiles, jobs);
+
+	while (next < num_tracefiles || running > 0) {
+		/* start workers while there are free slots */
+		if (next < num_tracefiles && running < jobs) {
+			int fd[2];
+
+			if (pipe(fd) == -1)
+				unix_error("pipe failed in run_tests_parallel");
+			if ((pids[next] = fork()) == -1)
+				unix_error("fork failed in run_tests_parallel");
+			if (pids[next] == 0) {
+				close(fd[0]);
+				verbose = (verbose > 1) ? 1 : verbose;
+				check_trace(fd[1], tracedir, tracefiles[next]);
+				exit(0);
+			}
+			close(fd[1]);
+			fds[next++] = fd[0];
+			running++;
+			continue;
+		}
+
+		/* reap one, and take its result (short, since it is dead) */
+		pid_t pid = wait(&status);
+		if (pid == -1)
+			unix_error("wait failed in run_tests_parallel");
+		for (i = 0; i < next && pids[i] != pid; i++)
+			;
+		if (i == next)
+			continue;
+		running--;
+
+		if (read(fds[i], &r, sizeof(r)) == sizeof(r)) {
+			mm_stats[i] = r.stats;
+			errors += r.errors;
+			if (profile_every) {
+				if ((mm_stats[i].prof = malloc(sizeof(r.prof))) == NULL)
+					unix_error("malloc failed in run_tests_parallel");
+				*mm_stats[i].prof = r.prof;
+			}
+		} else {
+			/* the worker died before it could report */
+			printf("ERROR [trace %s%s]: worker %s %d\n",
+					tracedir, tracefiles[i],
+					WIFSIGNALED(status) ? "killed by signal" : "exited with",
+					WIFSIGNALED(status) ? WTERMSIG(status) :
+					WEXITSTATUS(status));
+			errors++;
+			strcpy(mm_stats[i].filename, tracedir);
+			strcat(mm_stats[i].filename, tracefiles[i]);
+			mm_stats[i].valid = 0;
+		}
+		close(fds[i]);
+	}
+
+	/* Time on one core, so traces are not measured while other work
+	   (or a migration) disturbs them */
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	CPU_ZERO(&one);
+	for (i = 0; i < CPU_SETSIZE && !CPU_ISSET(i, &allowed); i++)
+		;
+	CPU_SET(i, &one);
+	if (sched_setaffinity(0, sizeof(one), &one) == -1)
+		unix_error("sched_setaffinity failed in run_tests_parallel");
+	if (verbose > 1)
+		printf("Timing the valid traces on CPU %d.\n", i);
+
+	for (i = 0; i < num_tracefiles; i++) {
+		trace_t *trace;
+
+		if (!mm_stats[i].valid)
+			continue;
+		trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
+		speed_params->trace = trace;
+		speed_params->ranges = NULL;
+		mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+		mm_stats[i].timed = fsecs_stats(&mm_stats[i].timing);
+		if (counters_flag)
+			mm_stats[i].counted = perf_count(eval_mm_speed, speed_params,
+					mm_stats[i].events);
+		if (latency_flag) {
+			if ((mm_stats[i].lat = calloc(1, sizeof(latency_t))) == NULL)
+				unix_error("calloc failed in run_tests_parallel");
+			eval_mm_latency(trace, mm_stats[i].lat);
+		}
+		free_trace(trace);
+	}
+
+	sched_setaffinity(0, sizeof(allowed), &allowed);
+	free(pids);
+	free(fds);
+}
+
+/*
+ * run_huge_tests - time the valid traces again, with the simulated heap
+ *     moved onto huge pages, and leave it on normal pages afterwards
+ */
+static void run_huge_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, stats_t *mm_stats, speed_t *speed_params)
+{
+	static const char *names[] = { "4K", "transparent huge", "hugetlbfs" };
+	int i, pages;
+
+	mem_deinit();
+	pages = mem_init_pages(huge_pages);
+	if (pages != huge_pages)
+		fprintf(stderr, "No %s pages, falling back to %s pages for -L\n",
+				names[huge_pages], names[pages]);
+	if (pages != MEM_PAGES_SMALL) {
+		if (verbose > 1)
+			printf("\nTiming mm malloc on %s pages\n", names[pages]);
+		for (i = 0; i < num_tracefiles; i++) {
+			trace_t *trace;
+
+			if (!mm_stats[i].valid)
+				continue;
+			trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
+			speed_params->trace = trace;
+			speed_params->ranges = NULL;
+			mm_stats[i].huge_secs = fsecs(eval_mm_speed, speed_params);
+			free_trace(trace);
+		}
+	}
+	mem_deinit();
+	mem_init();
+}
+
 /**************
  * Main routine
  **************/
@@ -269,7 +554,7 @@ int main(int argc, char **argv)
 	/*
 	 * Read and interpret the command line arguments
 	 */
-	while ((c = getopt(argc, argv, "d:f:c:s:t:hAlD")) != EOF) {
+	while ((c = getopt(argc, argv, "d:f:c:s:t:T:H:P:O:L:j:hAlCDp")) != EOF) {
 		switch (c) {
 
 			case 'A': /* Hidden Autolab driver argument */
@@ -307,6 +592,19 @@ int main(int argc, char **argv)
 				run_libc = 1;
 				break;
 
+			case 'C': /* Count hardware events (perf_event_open) */
+				counters_flag = 1;
+				break;
+
+			case 'L': /* Time again with the heap on huge pages */
+				if (strcmp(optarg, "thp") == 0)
+					huge_pages = MEM_PAGES_THP;
+				else if (strcmp(optarg, "hugetlb") == 0)
+					huge_pages = MEM_PAGES_HUGETLB;
+				else
+					app_error("-L takes thp or hugetlb\n");
+				break;
+
 			case 'd':
 				debug_mode = atoi(optarg);
 				break;
@@ -319,6 +617,40 @@ int main(int argc, char **argv)
 				set_timeout = atoi(optarg);
 				break;
 
+			case 'p': /* Report per-call latency percentiles */
+				latency_flag = 1;
+				break;
+
+			case 'H': /* ... and write the latency histograms as CSV */
+				latency_flag = 1;
+				latency_csv = optarg;
+				break;
+
+			case 'P': /* Profile the heap every n requests */
+				profile_every = atoi(optarg);
+				if (profile_every < 1)
+					app_error("-P needs a positive request count\n");
+				break;
+
+			case 'j': /* Check traces in parallel worker processes */
+				jobs = atoi(optarg);
+				if (jobs < 1)
+					app_error("-j needs a positive number of workers\n");
+				break;
+
+			case 'O': /* ... and write the samples as CSV */
+				if ((profile_csv = fopen(optarg, "w")) == NULL)
+					unix_error("Could not open %s", optarg);
+				break;
+
+#ifdef MM_THREADS
+			case 'T': /* Replay each trace on up to this many threads */
+				max_threads = atoi(optarg);
+				if (max_threads < 1)
+					app_error("-T needs a positive thread count\n");
+				break;
+#endif
+
 			case 'h': /* Print this message */
 				usage();
 				exit(0);
@@ -341,6 +673,11 @@ int main(int argc, char **argv)
 
 	/* Initialize the timing package */
 	init_fsecs();
+	if (counters_flag && perf_init() == 0) {
+		fprintf(stderr, "Hardware counters are not available "
+				"(see /proc/sys/kernel/perf_event_paranoid), ignoring -C\n");
+		counters_flag = 0;
+	}
 
 	/* Initialize the timeout */
 	if (set_timeout) {
@@ -372,6 +709,10 @@ int main(int argc, char **argv)
 				if (verbose > 1)
 					printf("and performance.\n");
 				libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+				libc_stats[i].timed = fsecs_stats(&libc_stats[i].timing);
+				if (counters_flag)
+					libc_stats[i].counted = perf_count(eval_libc_speed,
+							&speed_params, libc_stats[i].events);
 			}
 			free_trace(trace);
 		}
@@ -380,6 +721,8 @@ int main(int argc, char **argv)
 		if (verbose) {
 			printf("\nResults for libc malloc:\n");
 			printresults(num_tracefiles, libc_stats);
+			printtiming(num_tracefiles, libc_stats);
+			printcounters(num_tracefiles, libc_stats);
 		}
 	}
 
@@ -397,8 +740,20 @@ int main(int argc, char **argv)
 	/* Initialize the simulated memory system in memlib.c */
 	mem_init();
 
-	run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-			ranges, &speed_params);
+	if (jobs > 1) {
+		/* workers can't share the timeout, the CSV file or -c's
+		   early exit */
+		if (onetime_flag || set_timeout || profile_csv != NULL)
+			app_error("-j can't be used with -c, -s or -O\n");
+		run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+				&speed_params);
+	} else {
+		run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+				ranges, &speed_params);
+	}
+	if (huge_pages != MEM_PAGES_SMALL && !onetime_flag)
+		run_huge_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+				&speed_params);
 
 
 	/* Display the mm results in a compact table */
@@ -413,10 +768,32 @@ int main(int argc, char **argv)
 		} else {
 			printf("\nResults for mm malloc:\n");
 			printresults(num_tracefiles, mm_stats);
+			printtiming(num_tracefiles, mm_stats);
+			printcounters(num_tracefiles, mm_stats);
+			printhuge(num_tracefiles, mm_stats);
+			printf("\n");
+			printfootprint(num_tracefiles, mm_stats);
 			printf("\n");
+			if (latency_flag) {
+				printlatency(num_tracefiles, mm_stats);
+				printf("\n");
+			}
+			if (profile_every) {
+				printprofile(num_tracefiles, mm_stats);
+				printf("\n");
+			}
 		}
+		if (latency_csv != NULL)
+			writelatency(num_tracefiles, mm_stats, latency_csv);
+		if (profile_csv != NULL)
+			fclose(profile_csv);
 	}
 
+#ifdef MM_THREADS
+	if (max_threads > 0 && errors == 0)
+		run_thread_tests(num_tracefiles, tracedir, tracefiles);
+#endif
+
 	/*
 	 * Accumulate the aggregate statistics for the student's mm package
 	 */
@@ -525,9 +902,11 @@ static int add_range(range_t **ranges, char *lo, int size,
 		return 0;
 	}
 
-	/* The payload must lie within the extent of the heap */
-	if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-			(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+	/* The payload must lie within the extent of the heap, or inside
+	   one of the mappings handed out by mem_map */
+	if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+			(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+			!mem_in_mapping(lo, hi)) {
 		malloc_error(trace, opnum,
 				"Payload (%p:%p) lies outside heap (%p:%p)",
 				lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -665,17 +1044,15 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Text (.rep)
+ *     traces are parsed; binary traces written by rep2bin are mapped.
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
 		const char *filename)
 {
 	FILE *tracefile;
 	trace_t *trace;
-	char type[MAXLINE];
-	int index, size;
-	int max_index = 0;
-	int op_index;
+	char magic[sizeof(TRACE_MAGIC)];
 
 	if (verbose > 1)
 		printf("Reading tracefile: %s\n", filename);
@@ -690,22 +1067,16 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 	if ((tracefile = fopen(trace->filename, "r")) == NULL) {
 		unix_error("Could not open %s in read_trace", trace->filename);
 	}
-	assert(fscanf(tracefile, "%d", &trace->weight) != EOF);
-	assert(fscanf(tracefile, "%d", &trace->num_ids) != EOF);
-	assert(fscanf(tracefile, "%d", &trace->num_ops) != EOF);
-	assert(fscanf(tracefile, "%d", &trace->ignore_ranges) != EOF);
-
-	if(trace->weight != 0 && trace->weight != 1) {
-		app_error("%s: weight can only be zero or one", trace->filename);
-	}
-	if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-		app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+	trace->map = NULL;
+	trace->map_len = 0;
+	if (fread(magic, sizeof(magic), 1, tracefile) == 1 &&
+			memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+		read_bin_trace(trace, fileno(tracefile));
+	} else {
+		rewind(tracefile);
+		read_rep_trace(trace, tracefile);
 	}
-
-	/* We'll store each request line in the trace in this array */
-	if ((trace->ops =
-				(traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-		unix_error("malloc 2 failed in read_trace");
+	fclose(tracefile);
 
 	/* We'll keep an array of pointers to the allocated blocks here... */
 	if ((trace->blocks =
@@ -722,6 +1093,47 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 				calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
 		unix_error("malloc 5 failed in read_trace");
 
+	/* fill in the stats */
+	strcpy(stats->filename, trace->filename);
+	stats->weight = trace->weight;
+	stats->ops = trace->num_ops;
+
+	return trace;
+}
+
+/*
+ * check_trace_header - sanity check the four header fields of a trace
+ */
+static void check_trace_header(trace_t *trace)
+{
+	if(trace->weight != 0 && trace->weight != 1) {
+		app_error("%s: weight can only be zero or one", trace->filename);
+	}
+	if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
+		app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+	}
+}
+
+/*
+ * read_rep_trace - parse a text trace into a freshly allocated ops array
+ */
+static void read_rep_trace(trace_t *trace, FILE *tracefile)
+{
+	char type[MAXLINE];
+	int index, size;
+	int max_index = 0;
+	int op_index;
+
+	assert(fscanf(tracefile, "%d", &trace->weight) != EOF);
+	assert(fscanf(tracefile, "%d", &trace->num_ids) != EOF);
+	assert(fscanf(tracefile, "%d", &trace->num_ops) != EOF);
+	assert(fscanf(tracefile, "%d", &trace->ignore_ranges) != EOF);
+	check_trace_header(trace);
+
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops =
+				(traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+		unix_error("malloc 2 failed in read_trace");
 
 	/* read every request line in the trace file */
 	index = 0;
@@ -754,16 +1166,55 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 		op_index++;
 		if(op_index == trace->num_ops) break;
 	}
-	fclose(tracefile);
 	assert(max_index == trace->num_ids - 1);
 	assert(trace->num_ops == op_index);
+}
 
-	/* fill in the stats */
-	strcpy(stats->filename, trace->filename);
-	stats->weight = trace->weight;
-	stats->ops = trace->num_ops;
+/*
+ * read_bin_trace - map a binary trace and point the ops array at the
+ *     records in it. The only pass over the ops checks that every
+ *     index fits in the block arrays.
+ */
+static void read_bin_trace(trace_t *trace, int fd)
+{
+	struct stat st;
+	const tracehdr_t *hdr;
+	int i;
 
-	return trace;
+	if (fstat(fd, &st) == -1)
+		unix_error("Could not stat %s in read_trace", trace->filename);
+	if ((size_t)st.st_size < sizeof(tracehdr_t))
+		app_error("%s: truncated binary trace", trace->filename);
+
+	trace->map_len = st.st_size;
+	trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (trace->map == MAP_FAILED)
+		unix_error("mmap failed in read_trace");
+
+	hdr = trace->map;
+	if (hdr->version != TRACE_VERSION || hdr->byteord != TRACE_BYTEORD ||
+			hdr->opsize != sizeof(traceop_t))
+		app_error("%s: binary trace was written by an incompatible rep2bin",
+				trace->filename);
+	trace->weight = hdr->weight;
+	trace->num_ids = hdr->num_ids;
+	trace->num_ops = hdr->num_ops;
+	trace->ignore_ranges = hdr->ignore_ranges;
+	check_trace_header(trace);
+	if (trace->num_ops < 0 || trace->num_ids < 0 || trace->map_len !=
+			sizeof(tracehdr_t) + (size_t)trace->num_ops * sizeof(traceop_t))
+		app_error("%s: binary trace has the wrong length", trace->filename);
+
+	trace->ops = (traceop_t *)(hdr + 1);
+	for (i = 0; i < trace->num_ops; i++) {
+		int index = trace->ops[i].index;
+		int lo = (trace->ops[i].type == FREE) ? -1 : 0; /* free(NULL) */
+
+		if (trace->ops[i].type < ALLOC || trace->ops[i].type > REALLOC ||
+				index < lo || index >= trace->num_ids)
+			app_error("%s: bad request %d in binary trace",
+					trace->filename, i);
+	}
 }
 
 /*
@@ -778,12 +1229,15 @@ static void reinit_trace(trace_t *trace)
 
 /*
  * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated or mapped in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-	free(trace->ops);         /* free the three arrays... */
-	free(trace->blocks);
+	if (trace->map != NULL)   /* unmap or free the ops... */
+		munmap(trace->map, trace->map_len);
+	else
+		free(trace->ops);
+	free(trace->blocks);      /* the three arrays... */
 	free(trace->block_sizes);
 	free(trace->block_rand_base);
 	free(trace);              /* and the trace record itself... */
@@ -929,15 +1383,16 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   Utilization is the ratio hwm/footprint, where footprint is the
+ *   most memory the student's malloc package held at once while
+ *   running the trace: the heap plus any blocks given their own
+ *   mapping with mem_map(). Without mappings this is just the heap
+ *   size, since mem_sbrk() doesn't let the brk pointer go down.
+ *   The peak and final footprint are also stored in *stats.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
 	int i;
 	int index;
@@ -948,6 +1403,9 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 	char *newp, *oldp;
 
 	reinit_trace(trace);
+	if (profile_every && stats->prof == NULL &&
+			(stats->prof = malloc(sizeof(mm_profile_t))) == NULL)
+		unix_error("malloc failed in eval_mm_util");
 
 	/* initialize the heap and the mm malloc package */
 	mem_reset_brk();
@@ -1014,12 +1472,19 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 		/* update the high-water mark */
 		max_total_size = (total_size > max_total_size) ?
 			total_size : max_total_size;
+
+		if (profile_every && (i + 1) % profile_every == 0)
+			sample_profile(trace, i + 1, stats->prof);
 	}
+	if (profile_every && trace->num_ops % profile_every != 0)
+		sample_profile(trace, trace->num_ops, stats->prof);
 
 	//printf("max_total_size = %f\n", (double)max_total_size);
 	//printf("mem_heapsize = %f\n", (double)mem_heapsize());
-	
-	return ((double)max_total_size / (double)mem_heapsize());
+	stats->peak = mem_peak_footprint();
+	stats->final = mem_heapsize() + mem_mapped_bytes();
+
+	return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 
@@ -1075,6 +1540,314 @@ static void eval_mm_speed(void *ptr)
 		}
 }
 
+/*
+ * read_tsc - the cycle counter, read inline so that timing a call adds
+ *     as little as possible to it
+ */
+static inline unsigned long read_tsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned hi, lo;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long)hi << 32) | lo;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * lat_bucket - histogram bucket of a latency: the values below LAT_SUB
+ *     get a bucket each, and every power of two above that is split
+ *     into LAT_SUB buckets by the bits below its leading one
+ */
+static int lat_bucket(unsigned long v)
+{
+	int msb;
+
+	if (v < LAT_SUB)
+		return v;
+	msb = 63 - __builtin_clzl(v);
+	return (msb - LAT_SUB_BITS + 1) * LAT_SUB +
+		((v >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* lat_bucket_lo/hi - smallest and largest latency in bucket b */
+static unsigned long lat_bucket_lo(int b)
+{
+	int shift = b / LAT_SUB - 1;
+
+	if (b < LAT_SUB)
+		return b;
+	return (unsigned long)(LAT_SUB + b % LAT_SUB) << shift;
+}
+
+static unsigned long lat_bucket_hi(int b)
+{
+	return (b + 1 < LAT_BUCKETS) ? lat_bucket_lo(b + 1) - 1 : ~0UL;
+}
+
+/*
+ * eval_mm_latency - Run the trace through the mm package once more,
+ *    reading the cycle counter around every call. The run before it
+ *    faults in the heap, and the cost of reading the counter itself is
+ *    measured up front and subtracted from every sample.
+ */
+static void eval_mm_latency(trace_t *trace, latency_t *lat)
+{
+	int i, index, type;
+	char *p, *block;
+	unsigned long t0, t1, d, ovhd = ~0UL;
+	speed_t params;
+
+	for (i = 0; i < 1000; i++) {
+		t0 = read_tsc();
+		t1 = read_tsc();
+		if (t1 - t0 < ovhd)
+			ovhd = t1 - t0;
+	}
+
+	params.trace = trace;
+	params.ranges = NULL;
+	eval_mm_speed(&params);
+
+	reinit_trace(trace);
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in eval_mm_latency");
+
+	for (i = 0; i < trace->num_ops; i++) {
+		index = trace->ops[i].index;
+		type = trace->ops[i].type;
+		switch (type) {
+
+			case ALLOC: /* mm_malloc */
+				t0 = read_tsc();
+				p = mm_malloc(trace->ops[i].size);
+				t1 = read_tsc();
+				if (p == NULL)
+					app_error("mm_malloc error in eval_mm_latency");
+				trace->blocks[index] = p;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				block = trace->blocks[index];
+				t0 = read_tsc();
+				p = mm_realloc(block, trace->ops[i].size);
+				t1 = read_tsc();
+				if (p == NULL && trace->ops[i].size != 0)
+					app_error("mm_realloc error in eval_mm_latency");
+				trace->blocks[index] = p;
+				break;
+
+			case FREE: /* mm_free */
+				block = (index < 0) ? NULL : trace->blocks[index];
+				t0 = read_tsc();
+				mm_free(block);
+				t1 = read_tsc();
+				break;
+
+			default:
+				app_error("Nonexistent request type in eval_mm_latency");
+		}
+		d = (t1 - t0 > ovhd) ? t1 - t0 - ovhd : 0;
+		lat->count[type][lat_bucket(d)]++;
+		lat->n[type]++;
+		if (d > lat->max[type])
+			lat->max[type] = d;
+	}
+}
+
+/*
+ * lat_percentile - the latency below which a fraction q of the calls of
+ *     one type fall, reported as the top of the bucket it lands in
+ */
+static unsigned long lat_percentile(const latency_t *lat, int type, double q)
+{
+	unsigned long seen = 0;
+	double want = q * lat->n[type];
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += lat->count[type][b];
+		if (seen > 0 && seen >= want)
+			break;
+	}
+	if (b == LAT_BUCKETS || lat_bucket_hi(b) > lat->max[type])
+		return lat->max[type];
+	return lat_bucket_hi(b);
+}
+
+#ifdef MM_THREADS
+/*
+ * replay_thread - Body of one replayer thread: run the whole trace
+ *    through the mm package using this thread's own block array.
+ */
+static void *replay_thread(void *arg)
+{
+	replay_t *r = arg;
+	trace_t *trace = r->trace;
+	char **blocks = r->blocks;
+	int i, index, rep;
+	char *p;
+
+	pthread_barrier_wait(r->start);
+	clock_gettime(CLOCK_MONOTONIC, &r->t0);
+
+	for (rep = 0; rep < r->reps; rep++) {
+	for (i = 0;  i < trace->num_ops;  i++) {
+		index = trace->ops[i].index;
+		switch (trace->ops[i].type) {
+
+			case ALLOC: /* mm_malloc */
+				if ((p = mm_malloc(trace->ops[i].size)) == NULL) {
+					r->failed = 1;
+					return NULL;
+				}
+				blocks[index] = p;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				p = mm_realloc(blocks[index], trace->ops[i].size);
+				if (p == NULL && trace->ops[i].size != 0) {
+					r->failed = 1;
+					return NULL;
+				}
+				blocks[index] = p;
+				break;
+
+			case FREE: /* mm_free */
+				if (index >= 0) {
+					mm_free(blocks[index]);
+					blocks[index] = NULL;
+				} else {
+					mm_free(NULL);
+				}
+				break;
+
+			default:
+				app_error("Nonexistent request type in replay_thread");
+		}
+	}
+	r->ops += trace->num_ops;
+
+	/* Free whatever the trace left behind before running it again */
+	for (i = 0; i < trace->num_ids; i++) {
+		if (blocks[i] != NULL) {
+			mm_free(blocks[i]);
+			blocks[i] = NULL;
+			r->ops++;
+		}
+	}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &r->t1);
+	return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay a trace on nthreads threads at once, each
+ *    thread running its own copy of the trace (repeated until it has
+ *    made REPLAY_MIN_OPS calls) against one shared mm heap. Returns the
+ *    wall-clock seconds from the first thread starting to the last one
+ *    finishing, and the total number of calls in *ops. Returns -1 if
+ *    the shared heap ran out of memory (every thread needs its own
+ *    copy of the trace's live data).
+ */
+static double eval_mm_threads(trace_t *trace, int nthreads, double *ops)
+{
+	pthread_t *tids;
+	replay_t *args;
+	pthread_barrier_t start;
+	double t0 = DBL_MAX, t1 = 0, t;
+	int i, failed = 0;
+
+	if ((tids = calloc(nthreads, sizeof(*tids))) == NULL ||
+			(args = calloc(nthreads, sizeof(*args))) == NULL)
+		unix_error("calloc failed in eval_mm_threads");
+
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in eval_mm_threads");
+
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		args[i].trace = trace;
+		args[i].reps = (REPLAY_MIN_OPS + trace->num_ops - 1) / trace->num_ops;
+		args[i].start = &start;
+		if ((args[i].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+			unix_error("calloc failed in eval_mm_threads");
+		if (pthread_create(&tids[i], NULL, replay_thread, &args[i]) != 0)
+			unix_error("pthread_create failed in eval_mm_threads");
+	}
+
+	pthread_barrier_wait(&start);
+	*ops = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tids[i], NULL);
+		t = args[i].t0.tv_sec + args[i].t0.tv_nsec / 1e9;
+		t0 = (t < t0) ? t : t0;
+		t = args[i].t1.tv_sec + args[i].t1.tv_nsec / 1e9;
+		t1 = (t > t1) ? t : t1;
+		*ops += args[i].ops;
+		failed |= args[i].failed;
+		free(args[i].blocks);
+	}
+	pthread_barrier_destroy(&start);
+
+	free(args);
+	free(tids);
+
+	return failed ? -1 : t1 - t0;
+}
+
+/*
+ * run_thread_tests - Replay every trace on 1, 2, 4, ... up to
+ *    max_threads threads and print the throughput and the speedup over
+ *    a single thread, so the allocator's scaling can be measured.
+ */
+static void run_thread_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles)
+{
+	stats_t stats;
+	int i, n;
+	double secs, ops, base;
+
+	printf("Multithreaded replay for mm malloc:\n");
+	printf("%8s%10s%10s%10s%9s  %s\n",
+			"threads", "ops", "secs", "Kops", "speedup", "trace");
+	for (i = 0; i < num_tracefiles; i++) {
+		trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+		base = 0;
+		for (n = 1; ; n = (2 * n < max_threads) ? 2 * n : max_threads) {
+			secs = eval_mm_threads(trace, n, &ops);
+			if (secs < 0) {
+				printf("%8d%10s%10s%10s%9s  %s (out of memory)\n",
+						n, "-", "-", "-", "-", trace->filename);
+				break;
+			}
+			if (n == 1)
+				base = ops / secs;
+			printf("%8d%10.0f%10.6f%10.0f%9.2f  %s\n",
+					n,
+					ops,
+					secs,
+					(ops / 1e3) / secs,
+					(ops / secs) / base,
+					trace->filename);
+			if (n == max_threads)
+				break;
+		}
+		free_trace(trace);
+	}
+	printf("\n");
+}
+#endif /* def MM_THREADS */
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1239,6 +2012,271 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printfootprint - prints the peak and final memory (heap plus mapped
+ *    blocks) the mm package held on each trace, in KB
+ */
+static void printfootprint(int n, stats_t *stats)
+{
+	int i;
+
+	printf("Footprint for mm malloc (KB):\n");
+	printf("  %10s%10s  %s\n", "peak", "final", "trace");
+	for (i=0; i < n; i++) {
+		if (stats[i].valid) {
+			printf("  %10.0f%10.0f  %s\n",
+					stats[i].peak / 1024.0,
+					stats[i].final / 1024.0,
+					stats[i].filename);
+		}
+		else {
+			printf("  %10s%10s  %s\n", "-", "-", stats[i].filename);
+		}
+	}
+}
+
+/*
+ * sample_profile - takes a heap profile after opnum requests of the
+ *     trace, keeping the latest in prof and writing it to the -O file
+ *     as a CSV row. The find_fit columns are the average number of free
+ *     blocks looked at per call so far, by the class of the request.
+ */
+static void sample_profile(const trace_t *trace, int opnum, mm_profile_t *prof)
+{
+	int i;
+
+	mm_profile(prof);
+	if (profile_csv == NULL)
+		return;
+
+	if (ftell(profile_csv) == 0) {
+		fprintf(profile_csv, "trace,ops,heap,free,free_blocks,largest,"
+				"ext_frag");
+		for (i = 0; i < MM_PROF_SIZES; i++)
+			fprintf(profile_csv, ",free_2^%d", i);
+		for (i = 0; i < MM_PROF_CLASSES; i++)
+			fprintf(profile_csv, ",list_%d", i);
+		for (i = 0; i < MM_PROF_CLASSES; i++)
+			fprintf(profile_csv, ",scan_%d", i);
+		fprintf(profile_csv, ",coalesce_none,coalesce_next,"
+				"coalesce_prev,coalesce_both,extends\n");
+	}
+
+	fprintf(profile_csv, "%s,%d,%zu,%zu,%lu,%zu,%.4f", trace->filename,
+			opnum, prof->heap_bytes, prof->free_bytes, prof->free_blocks,
+			prof->largest_free, prof->ext_frag);
+	for (i = 0; i < MM_PROF_SIZES; i++)
+		fprintf(profile_csv, ",%lu", prof->free_sizes[i]);
+	for (i = 0; i < MM_PROF_CLASSES; i++)
+		fprintf(profile_csv, ",%lu", prof->list_len[i]);
+	for (i = 0; i < MM_PROF_CLASSES; i++)
+		fprintf(profile_csv, ",%.2f", prof->fit_calls[i] == 0 ? 0 :
+				(double)prof->fit_steps[i] / prof->fit_calls[i]);
+	for (i = 0; i < 4; i++)
+		fprintf(profile_csv, ",%lu", prof->coalesce[i]);
+	fprintf(profile_csv, ",%lu\n", prof->extends);
+}
+
+/*
+ * printprofile - prints the heap profile of the mm malloc package at
+ *     the end of each trace, and the average find_fit scan length by
+ *     the size class of the request (classes start at 2^(4+c) bytes)
+ */
+static void printprofile(int n, stats_t *stats)
+{
+	int i, c;
+
+	printf("Heap profile for mm malloc at the end of each trace:\n");
+	printf("  %8s%9s%9s%6s%8s%8s%8s%8s%8s  %s\n", "freeblks", "freeKB",
+			"largeKB", "frag", "coal-0", "next", "prev", "both", "grows",
+			"trace");
+	for (i=0; i < n; i++) {
+		const mm_profile_t *prof = stats[i].prof;
+
+		if (prof == NULL)
+			continue;
+		printf("  %8lu%9.0f%9.0f%5.0f%%%8lu%8lu%8lu%8lu%8lu  %s\n",
+				prof->free_blocks,
+				prof->free_bytes / 1024.0,
+				prof->largest_free / 1024.0,
+				prof->ext_frag * 100.0,
+				prof->coalesce[0], prof->coalesce[1],
+				prof->coalesce[2], prof->coalesce[3], prof->extends,
+				stats[i].filename);
+	}
+
+	printf("\nAverage find_fit scan length by request class:\n  ");
+	for (c = 0; c < MM_PROF_CLASSES; c++)
+		printf("%5d", c);
+	printf("  trace\n");
+	for (i=0; i < n; i++) {
+		const mm_profile_t *prof = stats[i].prof;
+
+		if (prof == NULL)
+			continue;
+		printf("  ");
+		for (c = 0; c < MM_PROF_CLASSES; c++) {
+			if (prof->fit_calls[c] == 0)
+				printf("%5s", "-");
+			else
+				printf("%5.1f", (double)prof->fit_steps[c] / prof->fit_calls[c]);
+		}
+		printf("  %s\n", stats[i].filename);
+	}
+}
+
+/*
+ * printtiming - prints the spread of the timed runs behind secs for
+ *     every trace, when the timer keeps them
+ */
+static void printtiming(int n, stats_t *stats)
+{
+	int i, header = 0;
+
+	for (i=0; i < n; i++) {
+		if (!stats[i].valid || !stats[i].timed)
+			continue;
+		if (!header) {
+			printf("\nTiming over %d runs (ms):\n", stats[i].timing.n);
+			printf("  %10s%10s%10s%10s  %s\n",
+					"median", "mean", "stddev", "ci95", "trace");
+			header = 1;
+		}
+		printf("  %10.4f%10.4f%10.4f%9.1f%%  %s\n",
+				stats[i].timing.median * 1e3,
+				stats[i].timing.mean * 1e3,
+				stats[i].timing.stddev * 1e3,
+				stats[i].timing.mean == 0 ? 0 :
+				100.0 * stats[i].timing.ci95 / stats[i].timing.mean,
+				stats[i].filename);
+	}
+}
+
+/*
+ * printcounters - prints the hardware events of one run of every
+ *     trace per request, next to its throughput (with -C)
+ */
+static void printcounters(int n, stats_t *stats)
+{
+	int i, e, header = 0;
+
+	for (i=0; i < n; i++) {
+		if (!stats[i].valid || !stats[i].counted)
+			continue;
+		if (!header) {
+			printf("\nHardware events per request:\n");
+			printf("  %8s", "Kops");
+			for (e = 0; e < PERF_NEVENTS; e++)
+				printf("%10s", perf_name(e));
+			printf("%6s  %s\n", "IPC", "trace");
+			header = 1;
+		}
+		printf("  %8.0f", stats[i].secs > 0 ?
+				stats[i].ops / 1e3 / stats[i].secs : 0);
+		for (e = 0; e < PERF_NEVENTS; e++) {
+			if (stats[i].events[e] < 0)
+				printf("%10s", "n/a");
+			else
+				printf("%10.2f", stats[i].events[e] / stats[i].ops);
+		}
+		if (stats[i].events[PERF_CYCLES] > 0 &&
+				stats[i].events[PERF_INSTRUCTIONS] >= 0)
+			printf("%6.2f", stats[i].events[PERF_INSTRUCTIONS] /
+					stats[i].events[PERF_CYCLES]);
+		else
+			printf("%6s", "n/a");
+		printf("  %s\n", stats[i].filename);
+	}
+}
+
+/*
+ * printhuge - prints the throughput of every trace on a heap of normal
+ *     pages next to the throughput on huge pages (with -L)
+ */
+static void printhuge(int n, stats_t *stats)
+{
+	int i, header = 0;
+
+	for (i=0; i < n; i++) {
+		if (!stats[i].valid || stats[i].huge_secs <= 0 || stats[i].secs <= 0)
+			continue;
+		if (!header) {
+			printf("\nThroughput with the heap on huge pages:\n");
+			printf("  %10s%10s%9s  %s\n", "4K Kops", "2M Kops", "speedup",
+					"trace");
+			header = 1;
+		}
+		printf("  %10.0f%10.0f%8.1f%%  %s\n",
+				stats[i].ops / 1e3 / stats[i].secs,
+				stats[i].ops / 1e3 / stats[i].huge_secs,
+				100.0 * (stats[i].secs / stats[i].huge_secs - 1),
+				stats[i].filename);
+	}
+}
+
+/*
+ * printlatency - prints the per-call latency percentiles of the mm
+ *     malloc package for each trace and request type
+ */
+static void printlatency(int n, stats_t *stats)
+{
+	static const char *names[] = { "malloc", "free", "realloc" };
+	int i, type;
+
+	printf("Latency for mm malloc (cycles):\n");
+	printf("  %-8s%9s%8s%8s%8s%8s%10s  %s\n",
+			"op", "calls", "p50", "p90", "p99", "p99.9", "max", "trace");
+	for (i=0; i < n; i++) {
+		const latency_t *lat = stats[i].lat;
+
+		for (type = ALLOC; type <= REALLOC; type++) {
+			if (lat == NULL || lat->n[type] == 0)
+				continue;
+			printf("  %-8s%9lu%8lu%8lu%8lu%8lu%10lu  %s\n",
+					names[type],
+					lat->n[type],
+					lat_percentile(lat, type, 0.50),
+					lat_percentile(lat, type, 0.90),
+					lat_percentile(lat, type, 0.99),
+					lat_percentile(lat, type, 0.999),
+					lat->max[type],
+					stats[i].filename);
+		}
+	}
+}
+
+/*
+ * writelatency - writes every non-empty latency histogram bucket as a
+ *     CSV row: trace, op, lowest and highest cycles, count
+ */
+static void writelatency(int n, stats_t *stats, const char *filename)
+{
+	static const char *names[] = { "malloc", "free", "realloc" };
+	FILE *fp;
+	int i, type, b;
+
+	if ((fp = fopen(filename, "w")) == NULL)
+		unix_error("Could not open %s in writelatency", filename);
+	fprintf(fp, "trace,op,lo,hi,count\n");
+	for (i=0; i < n; i++) {
+		const latency_t *lat = stats[i].lat;
+
+		if (lat == NULL)
+			continue;
+		for (type = ALLOC; type <= REALLOC; type++) {
+			for (b = 0; b < LAT_BUCKETS; b++) {
+				if (lat->count[type][b] == 0)
+					continue;
+				fprintf(fp, "%s,%s,%lu,%lu,%lu\n",
+						stats[i].filename, names[type],
+						lat_bucket_lo(b), lat_bucket_hi(b),
+						lat->count[type][b]);
+			}
+		}
+	}
+	fclose(fp);
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1284,7 +2322,8 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+	fprintf(stderr, "Usage: mdriver [-hlCVdDp] [-f <file>] [-j <n>] [-H <file>] "
+			"[-P <n> [-O <file>]] [-L thp|hugetlb]\n");
 	fprintf(stderr, "Options\n");
 	fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
 	fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1294,4 +2333,14 @@ static void usage(void)
 	fprintf(stderr, "\t-l         Run libc malloc as well.\n");
 	fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
 	fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+	fprintf(stderr, "\t-C         Count hardware events per request (perf_event_open).\n");
+	fprintf(stderr, "\t-p         Time each call and print latency percentiles.\n");
+	fprintf(stderr, "\t-H <file>  Like -p, and write the histograms to CSV <file>.\n");
+	fprintf(stderr, "\t-j <n>     Check traces in n parallel processes, then time them.\n");
+	fprintf(stderr, "\t-P <n>     Profile the heap every n requests.\n");
+	fprintf(stderr, "\t-O <file>  With -P, write the profile samples to CSV <file>.\n");
+	fprintf(stderr, "\t-L <kind>  Time again with the heap on thp or hugetlb 2 MB pages.\n");
+#ifdef MM_THREADS
+	fprintf(stderr, "\t-T <n>     Also replay each trace on up to n threads.\n");
+#endif
 }
@@ -19,21 +19,87 @@
 static unsigned char *heap;
 static unsigned char *mem_brk;
 static unsigned char *mem_max_addr;
+static int heap_pages;        /* MEM_PAGES_xxx the heap is backed by */
+static size_t heap_pagesize;  /* and the size of those pages */
+
+/* Side table of the mappings handed out by mem_map, sorted by address */
+typedef struct {
+    void *addr;
+    size_t len;
+} mapping_t;
+
+static mapping_t *mappings;
+static int num_mappings;
+static int max_mappings;
+static size_t mapped_bytes;   /* total length of all live mappings */
+static size_t peak_footprint; /* high-water mark of heap + mappings */
+static char map_lock;         /* spin lock for the side table */
+
+static int find_mapping(void *addr);
+static void lock_mappings(void);
+static void unlock_mappings(void);
+static void update_peak(void);
+static int thp_enabled(void);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-  int dev_zero = open("/dev/zero", O_RDWR);
-  heap = mmap((void *)0x800000000, /* suggested start*/
-              MAX_HEAP,            /* length */
-              PROT_WRITE,          /* permissions */
-              MAP_PRIVATE,         /* private or shared? */
-              dev_zero,            /* fd */
-              0);                  /* offset (dunno) */
+  mem_init_pages(MEM_PAGES_SMALL);
+}
+
+/*
+ * mem_init_pages - initialize the memory system model with the heap
+ *    backed by 2 MB pages: MEM_PAGES_HUGETLB asks for explicit huge pages
+ *    (which have to be reserved in /proc/sys/vm/nr_hugepages), and
+ *    MEM_PAGES_THP for transparent huge pages. If the kind asked for is
+ *    not available the next smaller one is tried, down to normal pages.
+ *    Returns the kind the heap actually got.
+ */
+int mem_init_pages(int pages)
+{
+  void *addr = (void *)0x800000000; /* suggested start, 2 MB aligned */
+
+  heap = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (pages == MEM_PAGES_HUGETLB) {
+    heap = mmap(addr, MAX_HEAP, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    heap_pagesize = HUGE_PAGESIZE;
+  }
+#endif
+#ifdef MADV_HUGEPAGE
+  if (heap == MAP_FAILED && pages >= MEM_PAGES_THP && thp_enabled()) {
+    pages = MEM_PAGES_THP;
+    heap = mmap(addr, MAX_HEAP, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    heap_pagesize = HUGE_PAGESIZE;
+    /* THP is off, or the mapping is not 2 MB aligned */
+    if (heap != MAP_FAILED &&
+        (((unsigned long)heap & (HUGE_PAGESIZE - 1)) != 0 ||
+         madvise(heap, MAX_HEAP, MADV_HUGEPAGE) != 0)) {
+      munmap(heap, MAX_HEAP);
+      heap = MAP_FAILED;
+    }
+  }
+#endif
+  if (heap == MAP_FAILED) {
+    int dev_zero = open("/dev/zero", O_RDWR);
+    pages = MEM_PAGES_SMALL;
+    heap = mmap(addr,                /* suggested start*/
+                MAX_HEAP,            /* length */
+                PROT_WRITE,          /* permissions */
+                MAP_PRIVATE,         /* private or shared? */
+                dev_zero,            /* fd */
+                0);                  /* offset (dunno) */
+    close(dev_zero);
+    heap_pagesize = mem_pagesize();
+  }
+  heap_pages = pages;
   mem_max_addr = heap + MAX_HEAP;
   mem_brk = heap;                  /* heap is empty initially */
+  return pages;
 }
 
 /* 
@@ -41,35 +107,258 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+  mem_reset_brk();
   munmap(heap, MAX_HEAP);
+  free(mappings);
+  mappings = NULL;
+  max_mappings = 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and release every mapping still handed out by mem_map
  */
 void mem_reset_brk()
 {
+    int i;
+
     mem_brk = heap;
+    for (i = 0; i < num_mappings; i++)
+	munmap(mappings[i].addr, mappings[i].len);
+    num_mappings = 0;
+    mapped_bytes = 0;
+    peak_footprint = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr is an error; use mem_trim to shrink the heap. The
+ *    brk pointer is moved with a compare-and-swap, so several threads
+ *    may call it at once.
  */
 void *mem_sbrk(int incr) 
 {
-    unsigned char *old_brk = mem_brk;
+    unsigned char *old_brk = __atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
+    do {
+	if ( (incr < 0) || ((old_brk + incr) > mem_max_addr)) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&mem_brk, &old_brk, old_brk + incr,
+					  0, __ATOMIC_ACQ_REL,
+					  __ATOMIC_ACQUIRE));
+    update_peak();
     return (void *)old_brk;
 }
 
+/*
+ * mem_trim - the opposite of mem_sbrk: lower the brk pointer by decr
+ *    bytes. Every whole page above the new brk is given back to the OS
+ *    with madvise(MADV_FREE), which lets the kernel reclaim it lazily,
+ *    so a heap that grows over it again before then takes no page
+ *    faults; its contents are undefined. Where MADV_FREE is not
+ *    supported, MADV_DONTNEED is used. On a huge page heap only whole
+ *    2 MB pages are given back, so the rest are not split. Returns 0,
+ *    or -1 if decr is more than the heap.
+ */
+int mem_trim(size_t decr)
+{
+    size_t pagesize = heap_pagesize;
+    unsigned char *old_brk = __atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE);
+    unsigned long first, last;
+
+    do {
+	if (decr > (size_t)(old_brk - heap)) {
+	    errno = EINVAL;
+	    return -1;
+	}
+    } while (!__atomic_compare_exchange_n(&mem_brk, &old_brk, old_brk - decr,
+					  0, __ATOMIC_ACQ_REL,
+					  __ATOMIC_ACQUIRE));
+
+    /* release the pages that now lie entirely above the brk */
+    first = ((unsigned long)(old_brk - decr) + pagesize - 1) & ~(pagesize - 1);
+    last = (unsigned long)old_brk & ~(pagesize - 1);
+    if (first < last) {
+#ifdef MADV_FREE
+	if (madvise((void *)first, last - first, MADV_FREE) == 0)
+	    return 0;
+#endif
+	madvise((void *)first, last - first, MADV_DONTNEED);
+    }
+    return 0;
+}
+
+/*
+ * mem_map - give the caller a private, zero-filled mapping of at least
+ *    len bytes outside the heap, rounded up to whole pages. The mapping
+ *    is recorded in a side table until mem_unmap (or mem_reset_brk)
+ *    releases it. Returns NULL on failure.
+ */
+void *mem_map(size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    void *addr;
+    int i;
+
+    len = (len + pagesize - 1) & ~(pagesize - 1);
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+	return NULL;
+
+    lock_mappings();
+    if (num_mappings == max_mappings) {
+	int n = max_mappings ? 2 * max_mappings : 64;
+	mapping_t *m = realloc(mappings, n * sizeof(mapping_t));
+	if (m == NULL) {
+	    unlock_mappings();
+	    munmap(addr, len);
+	    return NULL;
+	}
+	mappings = m;
+	max_mappings = n;
+    }
+    i = find_mapping(addr) + 1;
+    memmove(&mappings[i + 1], &mappings[i],
+	    (num_mappings - i) * sizeof(mapping_t));
+    mappings[i].addr = addr;
+    mappings[i].len = len;
+    num_mappings++;
+    __atomic_fetch_add(&mapped_bytes, len, __ATOMIC_RELAXED);
+    unlock_mappings();
+
+    update_peak();
+    return addr;
+}
+
+/*
+ * mem_unmap - give a mapping from mem_map back to the OS. Returns 0, or
+ *    -1 if addr is not the start of a live mapping.
+ */
+int mem_unmap(void *addr)
+{
+    int i;
+
+    lock_mappings();
+    i = find_mapping(addr);
+    if (i < 0 || mappings[i].addr != addr) {
+	unlock_mappings();
+	return -1;
+    }
+    munmap(addr, mappings[i].len);
+    __atomic_fetch_sub(&mapped_bytes, mappings[i].len, __ATOMIC_RELAXED);
+    num_mappings--;
+    memmove(&mappings[i], &mappings[i + 1],
+	    (num_mappings - i) * sizeof(mapping_t));
+    unlock_mappings();
+    return 0;
+}
+
+/*
+ * mem_in_mapping - return true if [lo, hi] lies inside one mapping
+ */
+int mem_in_mapping(void *lo, void *hi)
+{
+    int i, found = 0;
+
+    lock_mappings();
+    i = find_mapping(lo);
+    if (i >= 0) {
+	char *start = mappings[i].addr;
+	found = ((char *)hi < start + mappings[i].len);
+    }
+    unlock_mappings();
+    return found;
+}
+
+/*
+ * mem_mapped_bytes - return the total size of the live mappings
+ */
+size_t mem_mapped_bytes(void)
+{
+    return __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_peak_footprint - return the most memory (heap plus mappings) the
+ *    allocator has held at once since the last mem_reset_brk
+ */
+size_t mem_peak_footprint(void)
+{
+    return peak_footprint;
+}
+
+/*
+ * update_peak - fold the current footprint into peak_footprint
+ */
+static void update_peak(void)
+{
+    unsigned char *brk = __atomic_load_n(&mem_brk, __ATOMIC_RELAXED);
+    size_t now = (size_t)(brk - heap) + mem_mapped_bytes();
+    size_t peak = __atomic_load_n(&peak_footprint, __ATOMIC_RELAXED);
+
+    while (now > peak &&
+	   !__atomic_compare_exchange_n(&peak_footprint, &peak, now, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * thp_enabled - return true unless transparent huge pages are turned
+ *    off (madvise(MADV_HUGEPAGE) succeeds even then)
+ */
+static int thp_enabled(void)
+{
+    char buf[128];
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    int on = 0;
+
+    if (f == NULL)
+	return 0;
+    if (fgets(buf, sizeof(buf), f) != NULL)
+	on = (strstr(buf, "[never]") == NULL);
+    fclose(f);
+    return on;
+}
+
+/*
+ * find_mapping - binary search the side table for the last mapping that
+ *    starts at or below addr. Returns its index, or -1 if there is none.
+ *    The caller holds the lock.
+ */
+static int find_mapping(void *addr)
+{
+    int lo = 0, hi = num_mappings - 1;
+
+    while (lo <= hi) {
+	int mid = lo + (hi - lo) / 2;
+	if ((char *)mappings[mid].addr <= (char *)addr)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return hi;
+}
+
+/*
+ * lock_mappings/unlock_mappings - a tiny spin lock, so the side table
+ *    can be used from several threads without linking in pthreads
+ */
+static void lock_mappings(void)
+{
+    while (__atomic_test_and_set(&map_lock, __ATOMIC_ACQUIRE))
+	;
+}
+
+static void unlock_mappings(void)
+{
+    __atomic_clear(&map_lock, __ATOMIC_RELEASE);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -94,6 +383,14 @@ size_t mem_heapsize()
     return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_heap_pages() - returns the MEM_PAGES_xxx kind the heap is backed by
+ */
+int mem_heap_pages(void)
+{
+    return heap_pages;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
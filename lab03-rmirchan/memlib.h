@@ -1,11 +1,23 @@
 #include <unistd.h>
 
+/* The pages behind the simulated heap (mem_init_pages) */
+enum { MEM_PAGES_SMALL, MEM_PAGES_THP, MEM_PAGES_HUGETLB };
+#define HUGE_PAGESIZE (2UL << 20)
+
 void mem_init(void);               
+int mem_init_pages(int pages);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+int mem_trim(size_t decr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+int mem_heap_pages(void);
+void *mem_map(size_t len);
+int mem_unmap(void *addr);
+int mem_in_mapping(void *lo, void *hi);
+size_t mem_mapped_bytes(void);
+size_t mem_peak_footprint(void);
 
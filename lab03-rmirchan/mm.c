@@ -1,26 +1,105 @@
 /*
- * mm-explicit.c - Explicit allocator with a first-fit
- * free list with binary segregation).
+ * mm-explicit.c - Explicit allocator with segregated first-fit
+ * free lists.
  *
  *
 
  *
  * Structure of each block:
- * allocated : | Header(4) | Payload | Footer(4)|
- * freed     : | Header(4) | Prev_ptr(8) | Next_ptr(8) | Footer(4) |
- * Since each block must be able to hold 2 8 byte pointers in
- * its payload, the minimum block size is 24.
+ * allocated : | Header(4) | Payload |
+ * freed     : | Header(4) | Prev_off(4) | Next_off(4) | ... | Footer(4) |
  *
- * The free list works by having one global pointer to the head
- * free block. Each pointer is located one space to the left of the ptr
- * to the next block in the list, and holds the address of the previous block
- * in the list.
+ * Only free blocks carry a footer. Bit 0 of the header is the block's
+ * own allocated bit and bit 1 records whether the block just before it
+ * is allocated, so coalesce() only reads the previous footer when that
+ * block is actually free. The free list links are 4 byte offsets from
+ * the start of the heap (which is far smaller than 4GB), so the
+ * minimum block size is 16 and an allocated block pays only 4 bytes.
  *
- * There is a small segregation factor of the free list because
- * there is a seperate free list for very large blocks.
- * This ensure that if the user wants to allocate a large size  block,
- * its lookup time will be less because it only has to look at the
- * large-block free-list, which will be inherently shorter.
+ * Free blocks are kept in NUM_CLASSES segregated classes. Every block
+ * up to BIG_SIZE lives in the list of its power-of-two size class,
+ * so class c holds blocks with sizes in [2^(c+4), 2^(c+5)). Each list
+ * is doubly linked: the first word of the payload holds the offset of
+ * the previous free block and the second word holds the next one.
+ *
+ * Blocks larger than BIG_SIZE all share the last class, BIG_CLASS,
+ * which is a top-down splay tree keyed on (size, address) instead of a
+ * list. The same two payload words hold the left and right children.
+ * Large requests are served best-fit from the tree in amortized
+ * O(log n), so a big block is no longer split just because it happened
+ * to be found first.
+ *
+ * A bitmap (seg_bitmap) has bit c set whenever list c is non-empty.
+ * find_fit scans only the first few blocks of the request's own class,
+ * and if none of them is large enough it picks the head of the next
+ * non-empty class above it with a single count-trailing-zeros, so
+ * lookups no longer depend on how many free blocks are in the heap.
+ *
+ * The lists are LIFO by default: a freed block goes to the head of its
+ * list. Building with -DADDR_ORDER=1 keeps every list sorted by address
+ * instead, so find_fit's first fit is the lowest block that fits, which
+ * packs the heap tighter at some cost in speed. To find a block's place
+ * without walking the whole list, the sorted lists carry a skip list:
+ * a free block of 24 bytes or more may get a random number of extra
+ * forward links (as many as fit) after its list offsets.
+ *
+ * Requests of MMAP_THRESHOLD bytes or more never touch the heap. Each
+ * one gets its own page-aligned mapping from mem_map, laid out as
+ * | Padding(4) | Header(4) | Payload |, with the MMAPPED bit set in the
+ * header and the mapping length as its size. free() sees the bit and
+ * hands the whole mapping straight back, so big transient buffers no
+ * longer pin heap space.
+ *
+ * When a free leaves a free block of more than TRIM_THRESHOLD bytes
+ * right before the epilogue that is also most of the heap, trim_heap()
+ * keeps TRIM_PAD bytes of it and returns the rest of the tail to memlib
+ * with mem_trim(). If the heap later grows back over the trimmed pages,
+ * the threshold rises to the size of that tail, so a heap that keeps
+ * growing to the same peak stops paying for madvise and page faults.
+ *
+ * mm_profile() walks the heap and the free lists for the numbers that
+ * mm_checkheap() only checks: free block sizes, external fragmentation
+ * and the largest free block. It also returns counters kept since
+ * mm_init for how far find_fit scans, which coalesce cases occur and
+ * how often malloc grew the heap.
+ *
+ * Coalescing of small blocks is deferred. A freed block of up to
+ * FAST_MAX bytes stays marked allocated and goes on a quick list of
+ * blocks of exactly its size, which heap_alloc pops before it searches
+ * the free lists, so a program that frees and mallocs the same sizes no
+ * longer merges and re-splits the same blocks. The quick lists are
+ * coalesced into the free lists in one pass when a malloc finds no fit,
+ * and a list that grows past FAST_LIMIT blocks is flushed on its own.
+ *
+ * Requests of up to SLAB_MAX bytes skip all of that and are served
+ * from slabs, SLAB_SIZE-aligned blocks of the heap cut into objects of
+ * one size (a multiple of 8) with no header. Each slab keeps a free
+ * list of its objects, and the slabs of each size with room are kept
+ * on a list. A bitmap with one bit per SLAB_SIZE bytes of heap marks
+ * the slabs, so free() tells a slab object from a block in O(1). A
+ * class gets its first slab only once the heap holds enough live
+ * blocks of its size to fill one; until then its requests are ordinary
+ * heap blocks, so a trace with few small objects pins no empty slabs.
+ *
+ * Building with -DMM_THREADS makes the allocator thread-safe. All of
+ * the block and free list code above becomes the shared backing heap,
+ * guarded by heap_lock. In front of it, each thread keeps a cache of
+ * small blocks (up to TCACHE_MAX bytes) binned by exact block size, and
+ * each bin is backed by a central list with its own lock. Cached blocks
+ * stay marked allocated in the heap, so a malloc or free that hits the
+ * thread cache takes no lock at all. A thread refills or flushes its
+ * cache in batches through the central list of that size, and only goes
+ * to the backing heap when the central list is empty or overfull.
+ *
+ * The backing heap keeps one lock rather than one per size class. A
+ * free coalesces with its neighbours and a split leaves a remainder,
+ * and either may touch lists of any class as well as the big block
+ * tree, so per-class locks would have to be taken several at a time in
+ * class order. The caches already keep small requests off heap_lock
+ * (the login, perl and xterm traces take it on under 8% of calls), and
+ * the traces that take it on nearly every call, coalescing-bal and
+ * random-bal, coalesce on every free and would serialize on the
+ * neighbouring classes anyway.
  *
  */
 #include <assert.h>
@@ -28,9 +107,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -65,11 +148,29 @@
 
 #define WSIZE 4
 #define DSIZE 8     /* Word and header/footer size (bytes) */
-#define CHUNKSIZE  (1<<7)  /* Extend heap by this amount (bytes) */
+#define CHUNKSIZE  (1<<7)  /* Extend heap by at least this amount (bytes) */
 #define MAX(x, y) ((x) > (y)? (x) : (y))
-#define HEADER_SIZE 24 /* minimum block size (with pointers) */
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+#define HEADER_SIZE 16 /* minimum block size (with list offsets) */
+
+/* When malloc has to grow the heap, it asks for at least grow_step
+   bytes. The step doubles each time the heap grows again within
+   GROW_WINDOW heap allocations of the last time, and halves back
+   towards CHUNKSIZE when it doesn't, so a trace that ramps up makes few
+   big mem_sbrk calls and a steady one keeps small ones. The step is
+   capped at GROW_MAX and at 1/GROW_FRAC of the heap, which bounds the
+   space a last, unneeded step can waste. Override with -DGROW_MAX=n;
+   CHUNKSIZE gives a fixed step. */
+#ifndef GROW_MAX
+#define GROW_MAX (64 * 1024)
+#endif
+#define GROW_WINDOW 32
+#define GROW_FRAC 32
 
-/* Pack a size and allocated bit into a word */
+/* Header flag: the block before this one is allocated */
+#define PREV_ALLOC 0x2
+
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
@@ -79,40 +180,336 @@
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* Set or clear the previous-allocated flag in the header at p. These
+   are single atomic stores because, with MM_THREADS, the owner of an
+   allocated block reads its header (GET_ATOMIC) without the heap lock
+   while another thread may be updating this flag. */
+#define SET_PREV_ALLOC(p) \
+    __atomic_store_n((unsigned int *)(p), GET(p) | PREV_ALLOC, __ATOMIC_RELAXED)
+#define CLEAR_PREV_ALLOC(p) \
+    __atomic_store_n((unsigned int *)(p), GET(p) & ~PREV_ALLOC, __ATOMIC_RELAXED)
+#define GET_ATOMIC(p) __atomic_load_n((unsigned int *)(p), __ATOMIC_RELAXED)
+
+/* Header flag of a block that lives in its own mapping, not the heap */
+#define MMAPPED 0x4
+
+/* Requests of at least MMAP_THRESHOLD bytes bypass the heap and get a
+   mapping of their own from mem_map. Override with -DMMAP_THRESHOLD=n. */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128 * 1024)
+#endif
+
+/* A free block at the end of the heap bigger than TRIM_THRESHOLD, and
+   bigger than the rest of the heap, is cut down to TRIM_PAD bytes and
+   the rest is given back with mem_trim. Both the padding and the second
+   condition stop a tail that comes and goes in the middle of a trace
+   from being trimmed and faulted back in over and over; what gets
+   returned is the memory left behind after a burst. A tail that is
+   faulted back in after all raises the threshold (see trim_threshold).
+   Override the starting threshold with -DTRIM_THRESHOLD=n. */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128 * 1024)
+#endif
+#define TRIM_PAD ALIGN(TRIM_THRESHOLD / 2)
+
+/* Requests of up to SLAB_MAX bytes come from slabs: SLAB_SIZE-aligned
+   runs of equal objects with no per-object header. Small slabs and few
+   classes keep the space a half-empty slab holds on to low; bigger
+   values are faster but cost utilization on short traces. Override
+   with -DSLAB_MAX=n and -DSLAB_SIZE=n (a power of two of at most the
+   page size); SLAB_MAX 0 turns slabs off. The thread caches already serve
+   small requests without a lock, so MM_THREADS builds leave them off;
+   the slab code takes no lock of its own, so they must stay off. */
+#ifndef SLAB_MAX
+#ifdef MM_THREADS
+#define SLAB_MAX 0
+#else
+#define SLAB_MAX 24
+#endif
+#endif
+#ifndef SLAB_SIZE
+#define SLAB_SIZE 512
+#endif
+#if defined(MM_THREADS) && SLAB_MAX > 0
+#error "slabs are not thread-safe; build MM_THREADS with SLAB_MAX 0"
+#endif
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+#define SLAB_CLASS(size) (((size) - 1) / ALIGNMENT)
+/* heap block holding one slab: its payload is exactly the slab */
+#define SLAB_BLOCK ALIGN(SLAB_SIZE + WSIZE)
+/* objects in a slab of class c, and the heap block one of them would
+   otherwise take */
+#define SLAB_OBJECTS(c) ((SLAB_SIZE - SLAB_FIRST) / (((c) + 1) * ALIGNMENT))
+#define SLAB_HEAP_SIZE(c) MAX(ALIGN(((c) + 1) * ALIGNMENT + WSIZE), HEADER_SIZE)
+#define SMALL_BLOCK_MAX SLAB_HEAP_SIZE(SLAB_CLASSES - 1)
+
+/* Freed heap blocks of up to FAST_MAX bytes wait on quick lists, one
+   per 8 byte block size, instead of being coalesced right away; a list
+   longer than FAST_LIMIT is merged back. Override with -DFAST_MAX=n; 0
+   coalesces every free at once. MM_THREADS builds have the thread
+   caches, which do the same job, so they leave quick lists off. */
+#ifndef FAST_MAX
+#ifdef MM_THREADS
+#define FAST_MAX 0
+#else
+#define FAST_MAX 128
+#endif
+#endif
+#define FAST_LIMIT 64
+#define FAST_CLASSES (FAST_MAX / ALIGNMENT + 1)
+#define FAST_CLASS(size) ((size) / ALIGNMENT - 2)
+/* blocks on a quick list are linked through the first word of their
+   payload */
+#define FAST_NEXT(bp) (*(char **)(bp))
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks.
+   PREV_BLKP reads the previous footer, so it is only valid when the
+   previous block is free. */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
 /* defines the cutoff for the large part of the seg free list */
-#define BIG_SIZE 10000 * HEADER_SIZE
+#define BIG_SIZE (15000 * HEADER_SIZE)
+
+/* Segregated size classes. Class 0 starts at 2^MIN_CLASS_SHIFT bytes
+   and each following class doubles; BIG_CLASS is the splay tree of
+   every block above BIG_SIZE, and seg_heads[BIG_CLASS] is its root. */
+#define MIN_CLASS_SHIFT 4
+#define BIG_CLASS 14
+#define NUM_CLASSES (BIG_CLASS + 1)
+
+/* Convert between block pointers and the 4 byte heap offsets stored in
+ free blocks. Offset 0 is the alignment padding, so it stands for NULL. */
+#define BLK_OFF(bp)  ((bp) ? (unsigned int)((char *)(bp) - heap_base) : 0)
+#define OFF_BLK(off) ((off) ? heap_base + (off) : NULL)
 
 /* Given a pointer to a free block, compute
  address of next and prebvious blocks. The next block is stored one
  memory location down the heap. */
-#define NEXT_FREE_BLK(bp) (*((char **)(bp) + 1))
-#define PREV_FREE_BLK(bp) (*(char **)(bp))
+#define NEXT_FREE_BLK(bp) OFF_BLK(*((unsigned int *)(bp) + 1))
+#define PREV_FREE_BLK(bp) OFF_BLK(*(unsigned int *)(bp))
+#define SET_NEXT_FREE(bp, p) (*((unsigned int *)(bp) + 1) = BLK_OFF(p))
+#define SET_PREV_FREE(bp, p) (*(unsigned int *)(bp) = BLK_OFF(p))
+
+/* Blocks in the BIG_CLASS tree reuse the same two words as children */
+#define TREE_LEFT(bp)  PREV_FREE_BLK(bp)
+#define TREE_RIGHT(bp) NEXT_FREE_BLK(bp)
+#define SET_TREE_LEFT(bp, p)  SET_PREV_FREE(bp, p)
+#define SET_TREE_RIGHT(bp, p) SET_NEXT_FREE(bp, p)
+
+/* Free list order: 0 keeps each list LIFO, 1 sorts it by address and
+   indexes it with a skip list. Override with -DADDR_ORDER=1. */
+#ifndef ADDR_ORDER
+#define ADDR_ORDER 0
+#endif
+
+/* find_fit looks at no more than FIT_SCAN blocks of the request's own
+   class before it takes a block from a larger class. Address-ordered
+   lists start with the lowest blocks, which are often the small ones,
+   so they look further. Override with -DFIT_SCAN=n. */
+#ifndef FIT_SCAN
+#if ADDR_ORDER
+#define FIT_SCAN 64
+#else
+#define FIT_SCAN 8
+#endif
+#endif
+
+/* In an address-ordered list, the third word of a free block of at
+   least SKIP_MIN bytes holds its skip list height h, and the words after
+   it its next links on levels 1..h (level 0 is the list itself). A block
+   only gets as many levels as fit before its footer. */
+#define SKIP_LEVELS 8
+#define SKIP_MIN 24
+#define SKIP_ROOM(size) (((size) - SKIP_MIN + WSIZE) / WSIZE)
+#define SKIP_HEIGHT(bp) \
+    (GET_SIZE(HDRP(bp)) < SKIP_MIN ? 0 : *((unsigned int *)(bp) + 2))
+#define SET_SKIP_HEIGHT(bp, h) (*((unsigned int *)(bp) + 2) = (h))
+#define SKIP_NEXT(bp, l) OFF_BLK(*((unsigned int *)(bp) + 2 + (l)))
+#define SET_SKIP_NEXT(bp, l, p) (*((unsigned int *)(bp) + 2 + (l)) = BLK_OFF(p))
+
+/* Tree order: is the key (size, addr) below the free block bp? */
+#define KEY_LESS(size, addr, bp) \
+    ((size) < GET_SIZE(HDRP(bp)) || \
+     ((size) == GET_SIZE(HDRP(bp)) && (char *)(addr) < (char *)(bp)))
 
 static void *extend_heap(size_t w);
+static void *grow_heap(size_t asize);
+static void *heap_alloc(size_t asize);
+static void heap_free(void *ptr);
+static void *heap_realloc(void *oldptr, size_t size);
+static void *huge_alloc(size_t size);
+static void *huge_realloc(void *oldptr, size_t size);
+static void trim_heap(char * bp);
+static void fast_free(void * bp, size_t size);
+static void fast_flush(int c);
+static void fast_consolidate(void);
 static void *coalesce(void * block_ptr);
 static void *find_fit(size_t size);
 static void place(void *b, size_t size);
+static void split_block(void *b, size_t asize);
 static void insert_free(void * b, size_t size);
 static void remove_free(void * b);
+static int size_class(size_t size);
+static char *skip_find(int c, char * b, char ** pred);
+static unsigned int skip_height(size_t size);
+static char *tree_splay(char * t, size_t size, char * addr);
+static void tree_insert(char * b, size_t size);
+static void tree_remove(char * b);
+static char *tree_best_fit(size_t size, unsigned long * steps);
+static int check_tree(char * t, char * lo, char * hi);
+static int is_slab(void * ptr);
+static void *slab_alloc(size_t size);
+static void slab_free(void * ptr);
+static char *slab_new(int c);
+static void count_small(void * bp, int n);
+static void slab_link(char * s, int c);
+static void slab_unlink(char * s, int c);
+
+#ifdef MM_THREADS
+/* Per-thread caches of blocks from 16 to TCACHE_MAX bytes, one bin per
+   8 byte block size. Refills and flushes move TCACHE_BATCH blocks. */
+#define TCACHE_MAX 256
+#define TCACHE_CLASSES (TCACHE_MAX / ALIGNMENT - 1)
+#define TCLASS(size) ((size) / ALIGNMENT - 2)
+#define TCACHE_BATCH 16
+#define TCACHE_LIMIT (4 * TCACHE_BATCH)
+#define CENTRAL_LIMIT (32 * TCACHE_BATCH)
+
+/* Cached blocks are linked through the first word of their payload */
+#define CACHE_NEXT(bp) (*(char **)(bp))
+
+/* One thread's cache. It is only valid while generation matches
+   heap_generation; mm_init starts a new generation. */
+typedef struct {
+    unsigned int generation;
+    int count[TCACHE_CLASSES];
+    char * bins[TCACHE_CLASSES];
+} tcache_t;
+
+/* Blocks of one size shared by all threads */
+typedef struct {
+    pthread_mutex_t lock;
+    int count;
+    char * head;
+} central_t;
+
+static void *tcache_alloc(size_t asize);
+static void tcache_free(void * bp, size_t size);
+static void tcache_refill(tcache_t * tc, int c, size_t asize);
+static void tcache_flush(tcache_t * tc, int c, int n);
+static void tcache_release(void * arg);
+static void tcache_setup(void);
+
+/* guards every block header, free list and the big block tree of the
+   backing heap; see the header comment for why there is only one */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_HEAP() pthread_mutex_lock(&heap_lock)
+#define UNLOCK_HEAP() pthread_mutex_unlock(&heap_lock)
+
+static central_t central[TCACHE_CLASSES];
+static unsigned int heap_generation;
+static __thread tcache_t tcache;
+
+/* used to flush a thread's cache when the thread exits */
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#else
+#define LOCK_HEAP()
+#define UNLOCK_HEAP()
+#endif
 
-/* GLOBAL variables total 24 bytes for 3 pointers */
 /* global heap pointer that will point to the first memory block */
 static char * heap_pointer;
 
-/* global pointer that points to the head of the free list */
-static char * free_head;
+/* first byte of the heap; free list offsets are relative to it */
+static char * heap_base;
 
-/* global pointer that points to the head of the large size free list */
-static char * big_free_head;
+/* heads of the segregated free lists, one per size class */
+static char * seg_heads[NUM_CLASSES];
+
+/* bit c is set iff seg_heads[c] is non-empty */
+static unsigned long seg_bitmap;
+
+/* With ADDR_ORDER, the heads of levels 1.. of each list's skip list
+   (level 0 is seg_heads itself), and the state of the random number
+   generator that picks block heights */
+static char * skip_heads[BIG_CLASS][SKIP_LEVELS];
+static unsigned int skip_seed;
+
+/* Counters for mm_profile, reset by mm_init: find_fit calls and the
+   free blocks they looked at, by the request's class, and how often
+   coalesce found neither, the next, the previous or both neighbors
+   free. They are only touched with the heap locked. */
+#if NUM_CLASSES != MM_PROF_CLASSES
+#error "mm_profile_t needs one counter per size class"
+#endif
+/*
+ * The header at the start of every slab. Objects start right after it.
+ * Free objects are linked through their first word by offset within
+ * the slab; objects past carved have never been handed out.
+ */
+typedef struct {
+    unsigned int prev;       /* heap offsets of the neighboring slabs */
+    unsigned int next;       /* in the class's list of non-full slabs */
+    unsigned short free;     /* offset of the first free object, or 0 */
+    unsigned short carved;   /* offset of the first never-used object */
+    unsigned short size;     /* object size */
+    unsigned short used;     /* objects handed out */
+} slab_t;
+
+#define SLAB(s) ((slab_t *)(s))
+/* the slab that the object p lies in (heap_base is page aligned) */
+#define SLAB_OF(p) \
+    (heap_base + (((char *)(p) - heap_base) & ~(size_t)(SLAB_SIZE - 1)))
+#define SLAB_BIT(s) (((char *)(s) - heap_base) / SLAB_SIZE)
+#define SLAB_FIRST ALIGN(sizeof(slab_t))
+#define SLAB_FULL(sl) \
+    ((sl)->free == 0 && (sl)->carved + (sl)->size > SLAB_SIZE)
+
+/* per class, the slabs with room in them */
+static char * slab_heads[SLAB_CLASSES + 1];
+
+/* bit i is set iff the SLAB_SIZE bytes at heap offset i * SLAB_SIZE
+   are a slab, which lets free() recognize slab objects in O(1) */
+static unsigned long slab_map[MAX_HEAP / SLAB_SIZE / 64 + 1];
+
+/* live heap blocks handed out by malloc, by size in ALIGNMENT units, up
+   to SMALL_BLOCK_MAX; slab_alloc waits for SLAB_OBJECTS of them before
+   it makes a class its first slab */
+static int small_live[SMALL_BLOCK_MAX / ALIGNMENT + 1];
+
+/* the quick lists of freed blocks waiting to be coalesced, their
+   lengths, and how many blocks they hold in all */
+static char * fast_bins[FAST_CLASSES];
+static int fast_count[FAST_CLASSES];
+static int fast_total;
+
+/* the current growth step of grow_heap, the number of heap_alloc calls
+   so far and at the last growth, and how often the heap has grown */
+static size_t grow_step;
+static unsigned long heap_allocs;
+static unsigned long last_grow;
+static unsigned long heap_extends;
+
+/* trim_heap only trims a tail bigger than trim_threshold. trim_top is
+   the heap size the last trim left, and trim_size how much it gave
+   back; if the heap grows past trim_top again, the pages are being
+   faulted back in, so the threshold rises to trim_size and a tail that
+   big is kept from then on. mm_init starts each heap afresh. */
+static size_t trim_threshold;
+static size_t trim_top;
+static size_t trim_size;
+
+static unsigned long fit_calls[NUM_CLASSES];
+static unsigned long fit_steps[NUM_CLASSES];
+static unsigned long coalesce_cases[4];
 
 /*
  * mm_init - Called when a new trace starts.
@@ -125,19 +522,49 @@ int mm_init(void) {
     if (heap_pointer == (void *)-1) {
       return -1;
     }
-
-    /* initialize both list head pointers to 0*/
-    free_head = 0;
-    big_free_head = 0;
+    heap_base = heap_pointer;
+
+    /* initialize every list head pointer to 0 and clear the bitmap */
+    memset(seg_heads, 0, sizeof(seg_heads));
+    seg_bitmap = 0;
+    memset(skip_heads, 0, sizeof(skip_heads));
+    skip_seed = 2463534242U;
+    memset(fit_calls, 0, sizeof(fit_calls));
+    memset(fit_steps, 0, sizeof(fit_steps));
+    memset(coalesce_cases, 0, sizeof(coalesce_cases));
+    memset(slab_heads, 0, sizeof(slab_heads));
+    memset(fast_bins, 0, sizeof(fast_bins));
+    memset(fast_count, 0, sizeof(fast_count));
+    fast_total = 0;
+    grow_step = CHUNKSIZE;
+    heap_allocs = 0;
+    last_grow = 0;
+    heap_extends = 0;
+    trim_threshold = TRIM_THRESHOLD;
+    trim_top = 0;
+    trim_size = 0;
+    memset(slab_map, 0, sizeof(slab_map));
+    memset(small_live, 0, sizeof(small_live));
+
+#ifdef MM_THREADS
+    /* Forget every cached block; the heap they lived in is gone. */
+    pthread_once(&tcache_once, tcache_setup);
+    int c;
+    for (c = 0; c < TCACHE_CLASSES; c++) {
+        central[c].head = 0;
+        central[c].count = 0;
+    }
+    heap_generation++;
+#endif
 
     /* Create the start of the heap before prologue. Alignment padding */
     PUT(heap_pointer, 0);
     /* Create the prologue header (4 bytes) */
-    PUT(heap_pointer + WSIZE, PACK(2 * WSIZE, 1));
+    PUT(heap_pointer + WSIZE, PACK(2 * WSIZE, 1 | PREV_ALLOC));
     /* Prologue footer (4 bytes) */
     PUT (heap_pointer + (WSIZE * 2), PACK(2 * WSIZE, 1));
-    /* Epilogue (4 bytes) */
-    PUT (heap_pointer + (WSIZE * 3), PACK(0, 1));
+    /* Epilogue (4 bytes), after the allocated prologue */
+    PUT (heap_pointer + (WSIZE * 3), PACK(0, 1 | PREV_ALLOC));
 
     /* Set the global heap_pointer to the first memory block.
        In this case, it points to the prologue. */
@@ -169,7 +596,7 @@ static void *extend_heap(size_t w) {
       s = (w + 1) * WSIZE;
     }
 
-    /* Must be at least 24 bytes */
+    /* Must be at least 16 bytes */
     if (s < HEADER_SIZE) {
         s = HEADER_SIZE;
     }
@@ -179,9 +606,15 @@ static void *extend_heap(size_t w) {
           return NULL;
     }
 
+    /* growing back over trimmed pages: stop trimming a tail that big */
+    if (trim_top != 0 && mem_heapsize() > trim_top) {
+        trim_threshold = MAX(trim_threshold, trim_size);
+        trim_top = 0;
+    }
+
     /* Free block header/footer (after old epilogue) */
-    /* new block header */
-    PUT(HDRP(block_ptr), PACK(s, 0));
+    /* new block header, keeping the old epilogue's prev-alloc flag */
+    PUT(HDRP(block_ptr), PACK(s, GET_PREV_ALLOC(HDRP(block_ptr))));
     /* new block footer */
     PUT(FTRP(block_ptr), PACK(s, 0));
     /* New epilogue */
@@ -194,8 +627,38 @@ static void *extend_heap(size_t w) {
 }
 
 /*
- * malloc - Allocate a block by incrementing the brk pointer.
+ * grow_heap - Extend the heap for a request of asize bytes that nothing
+ *      in the free lists fits, and return the free block at its end,
+ *      which is then at least asize bytes. A free block already at the
+ *      end of the heap is topped up rather than left behind, and the
+ *      heap grows by at least grow_step.
+ */
+static void *grow_heap(size_t asize) {
+    char * epilogue = (char *)mem_heap_hi() + 1;
+    size_t need = asize;
+
+    /* the free tail is smaller than asize, or find_fit would have
+       returned it; extend_heap coalesces the new space with it */
+    if (!GET_PREV_ALLOC(HDRP(epilogue))) {
+        need -= GET_SIZE(HDRP(PREV_BLKP(epilogue)));
+    }
+
+    if (heap_allocs - last_grow < GROW_WINDOW) {
+        grow_step = MIN(2 * grow_step,
+                        MIN(GROW_MAX, MAX(mem_heapsize() / GROW_FRAC, CHUNKSIZE)));
+    } else {
+        grow_step = MAX(grow_step / 2, CHUNKSIZE);
+    }
+    last_grow = heap_allocs;
+    heap_extends++;
+
+    return extend_heap(MAX(need, grow_step) / WSIZE);
+}
+
+/*
+ * malloc - Allocate a block of at least size bytes.
  *      Always allocate a block whose size is a multiple of the alignment.
+ *      With MM_THREADS, small blocks come from the thread's own cache.
  */
 void *malloc(size_t size) {
     /* mm_checkheap(1); */
@@ -203,11 +666,191 @@ void *malloc(size_t size) {
         return NULL;
     }
 
-    /* fix for overhead and alignment */
-    size = MAX(ALIGN(size) + ALIGNMENT,  HEADER_SIZE);
+    if (size >= MMAP_THRESHOLD) {
+        return huge_alloc(size);
+    }
+
+    /* fix for header overhead and alignment */
+    size_t asize = MAX(ALIGN(size + WSIZE),  HEADER_SIZE);
+    void * ptr;
+
+    if (size <= SLAB_MAX && (ptr = slab_alloc(size)) != NULL) {
+        return ptr;
+    }
+
+#ifdef MM_THREADS
+    if (asize <= TCACHE_MAX && (ptr = tcache_alloc(asize)) != NULL) {
+        return ptr;
+    }
+#endif
+
+    LOCK_HEAP();
+    ptr = heap_alloc(asize);
+    if (ptr != NULL) {
+        count_small(ptr, 1);
+    }
+    UNLOCK_HEAP();
+    return ptr;
+}
+
+/*
+ * free - Give a block back to the heap (or, with MM_THREADS, to the
+ *      thread's cache if it is small). Mapped blocks go back to the OS.
+ */
+void free(void *ptr) {
+    // printf("free\n");
+    if (ptr == NULL) {
+        return;
+    }
+
+    /* a slab object has no header of its own, so look for it first */
+    if (is_slab(ptr)) {
+        slab_free(ptr);
+        return;
+    }
+
+    unsigned int header = GET_ATOMIC(HDRP(ptr));
+    if (header & MMAPPED) {
+        mem_unmap((char *)ptr - DSIZE);
+        return;
+    }
+
+    size_t size = header & ~0x7;
+#ifdef MM_THREADS
+    if (size <= TCACHE_MAX) {
+        tcache_free(ptr, size);
+        return;
+    }
+#endif
+
+    LOCK_HEAP();
+    count_small(ptr, -1);
+    if (FAST_MAX > 0 && size <= FAST_MAX) {
+        fast_free(ptr, size);
+    } else {
+        heap_free(ptr);
+    }
+    UNLOCK_HEAP();
+}
+
+/*
+ * realloc - Change the size of the block in place when we can, and
+ *      otherwise fall back to mallocing a new block, copying its data,
+ *      and freeing the old block.
+ */
+void *realloc(void *oldptr, size_t size) {
+    void *newptr;
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if(size == 0) {
+        free(oldptr);
+        return 0;
+    }
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if(oldptr == NULL) {
+        return malloc(size);
+    }
+
+    /* A slab object stays put while the new size fits in it */
+    if (is_slab(oldptr)) {
+        size_t oldsize = SLAB(SLAB_OF(oldptr))->size;
+        if (size <= oldsize) {
+            return oldptr;
+        }
+        if ((newptr = malloc(size)) == NULL) {
+            return 0;
+        }
+        memcpy(newptr, oldptr, oldsize);
+        slab_free(oldptr);
+        return newptr;
+    }
+
+    /* Moving into, out of, or between mappings */
+    if ((GET_ATOMIC(HDRP(oldptr)) & MMAPPED) || size >= MMAP_THRESHOLD) {
+        return huge_realloc(oldptr, size);
+    }
+
+    LOCK_HEAP();
+    count_small(oldptr, -1);
+    newptr = heap_realloc(oldptr, size);
+    count_small(newptr != NULL ? newptr : oldptr, 1);
+    UNLOCK_HEAP();
+    return newptr;
+}
+
+/*
+ * huge_alloc - Give a request its own mapping, just big enough for the
+ *      payload after the padding word and the header.
+ */
+static void *huge_alloc(size_t size) {
+    size_t pagesize = mem_pagesize();
+    size_t len = (size + DSIZE + pagesize - 1) & ~(pagesize - 1);
+
+    /* the length has to fit in the size bits of the header */
+    if (len > (~0U & ~0x7)) {
+        return NULL;
+    }
+
+    char * m = mem_map(len);
+    if (m == NULL) {
+        return NULL;
+    }
+    PUT(m + WSIZE, PACK(len, 1 | MMAPPED));
+    return m + DSIZE;
+}
+
+/*
+ * huge_realloc - Resize when the old block is mapped or the new size is
+ *      over MMAP_THRESHOLD. A mapping is kept if the new size still fits
+ *      and is not under half the threshold; anything else is copied.
+ */
+static void *huge_realloc(void *oldptr, size_t size) {
+    unsigned int header = GET_ATOMIC(HDRP(oldptr));
+    size_t oldsize = header & ~0x7;
+    void *newptr;
+
+    /* payload size of the old block */
+    oldsize -= (header & MMAPPED) ? DSIZE : WSIZE;
+
+    if ((header & MMAPPED) && size <= oldsize && size >= MMAP_THRESHOLD / 2) {
+        return oldptr;
+    }
+
+    if ((newptr = malloc(size)) == NULL) {
+        return 0;
+    }
+    memcpy(newptr, oldptr, size < oldsize ? size : oldsize);
+    free(oldptr);
+    return newptr;
+}
+
+/*
+ * heap_alloc - Allocate a block of asize bytes (already padded and
+ *      aligned) from the shared heap, growing it when nothing fits.
+ */
+static void *heap_alloc(size_t size) {
+    char * ptr;
+
+    heap_allocs++;
 
-    /* Find the first free fit using our find function and place */
-    char * ptr = find_fit(size);
+    /* A block of exactly this size that is waiting to be coalesced */
+    if (FAST_MAX > 0 && size <= FAST_MAX &&
+        (ptr = fast_bins[FAST_CLASS(size)]) != NULL) {
+        fast_bins[FAST_CLASS(size)] = FAST_NEXT(ptr);
+        fast_count[FAST_CLASS(size)]--;
+        fast_total--;
+        return ptr;
+    }
+
+    /* Find the first free fit using our find function and place. If
+       there is none, merge the quick lists in and try again before
+       growing the heap. */
+    ptr = find_fit(size);
+    if (ptr == NULL && fast_total > 0) {
+        fast_consolidate();
+        ptr = find_fit(size);
+    }
     if (ptr != NULL) {
         place(ptr, size);
         return ptr;
@@ -215,7 +858,7 @@ void *malloc(size_t size) {
 
     else {
         /* We need to allocate more space using extend_heap */
-        void * extend = extend_heap(MAX(size, CHUNKSIZE) / WSIZE);
+        void * extend = grow_heap(size);
         if (!extend) {
             /* not enough memory */
             return NULL;
@@ -231,59 +874,157 @@ void *malloc(size_t size) {
 }
 
 /*
- * free - We don't know how to free a block.  So we ignore this call.
- *      Computers have big memories; surely it won't be a problem.
+ * heap_free - Mark a block free and coalesce it into the shared heap.
  */
-void free(void *ptr) {
-    // printf("free\n");
-    if (ptr == NULL) {
-        return;
-    }
-
+static void heap_free(void *ptr) {
     /* get the size of current block */
     size_t size = GET_SIZE(HDRP(ptr));
 
-    /* set the header and footer flags */
-    PUT(HDRP(ptr), PACK(size, 0));
+    /* set the header and footer flags, keeping the prev-alloc flag */
+    PUT(HDRP(ptr), PACK(size, GET_PREV_ALLOC(HDRP(ptr))));
     PUT(FTRP(ptr), PACK(size, 0));
 
-    /* coalesce with adjecent blocks */
-    coalesce(ptr);
+    /* coalesce with adjecent blocks, and give a big tail back */
+    trim_heap(coalesce(ptr));
 
 }
 
 /*
- * realloc - Change the size of the block by mallocing a new block,
- *      copying its data, and freeing the old block.
+ * fast_free - Put the allocated block bp of size bytes on the quick list
+ *      of its size, leaving it marked allocated, and coalesce the list
+ *      if that makes it too long.
  */
-void *realloc(void *oldptr, size_t size) {
+static void fast_free(void * bp, size_t size) {
+    int c = FAST_CLASS(size);
+
+    FAST_NEXT(bp) = fast_bins[c];
+    fast_bins[c] = bp;
+    fast_total++;
+    if (++fast_count[c] > FAST_LIMIT) {
+        fast_flush(c);
+    }
+}
+
+/*
+ * fast_flush - Really free (and coalesce) every block on quick list c.
+ */
+static void fast_flush(int c) {
+    char * bp = fast_bins[c];
+
+    while (bp != NULL) {
+        char * next = FAST_NEXT(bp);
+        heap_free(bp);
+        bp = next;
+    }
+    fast_total -= fast_count[c];
+    fast_bins[c] = NULL;
+    fast_count[c] = 0;
+}
+
+/*
+ * fast_consolidate - Empty all of the quick lists into the free lists.
+ */
+static void fast_consolidate(void) {
+    int c;
+
+    for (c = 0; c < FAST_CLASSES; c++) {
+        if (fast_bins[c] != NULL) {
+            fast_flush(c);
+        }
+    }
+}
+
+/*
+ * trim_heap - if the free block bp is the last block in the heap and is
+ *      bigger than trim_threshold and than the rest of the heap, shrink
+ *      it to TRIM_PAD bytes and hand the rest back to memlib
+ */
+static void trim_heap(char * bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (size <= trim_threshold || size <= mem_heapsize() / 2 ||
+        GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0) {
+        return;
+    }
+
+    remove_free(bp);
+    if (mem_trim(size - TRIM_PAD) == -1) {
+        insert_free(bp, size);
+        return;
+    }
+
+    trim_top = mem_heapsize();
+    trim_size = size;
+
+    /* the shrunken block, then a new epilogue after a free block */
+    PUT(HDRP(bp), PACK(TRIM_PAD, PREV_ALLOC));
+    PUT(FTRP(bp), PACK(TRIM_PAD, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+    insert_free(bp, TRIM_PAD);
+}
+
+/*
+ * heap_realloc - Resize a non-NULL block to a non-zero size.
+ *
+ *      Shrinking splits the block. Growing first absorbs a free block
+ *      that follows it; if the block is the last one in the heap, the
+ *      heap is extended so that the tail grows without any copying.
+ */
+static void *heap_realloc(void *oldptr, size_t size) {
     size_t oldsize;
     void *newptr;
 
-    /* If size == 0 then this is just free, and we return NULL. */
-    if(size == 0) {
-        free(oldptr);
-        return 0;
+    /* same overhead and alignment fix as malloc */
+    size_t asize = MAX(ALIGN(size + WSIZE), HEADER_SIZE);
+    oldsize = GET_SIZE(HDRP(oldptr));
+
+    /* Shrinking (or staying the same) never moves the block */
+    if (asize <= oldsize) {
+        split_block(oldptr, asize);
+        return oldptr;
     }
 
-    /* If oldptr is NULL, then this is just malloc. */
-    if(oldptr == NULL) {
-        return malloc(size);
+    char * next = NEXT_BLKP(oldptr);
+    size_t avail = oldsize;
+    if (!GET_ALLOC(HDRP(next))) {
+        avail += GET_SIZE(HDRP(next));
+    }
+
+    /* If we are the last block (possibly followed by one free block),
+       grow the heap so the free space after us is big enough. The new
+       space is coalesced with that free block by extend_heap. */
+    if (avail < asize) {
+        char * last = GET_ALLOC(HDRP(next)) ? next : NEXT_BLKP(next);
+        if (GET_SIZE(HDRP(last)) == 0 &&
+            extend_heap((asize - avail) / WSIZE) != NULL) {
+            next = NEXT_BLKP(oldptr);
+            avail = oldsize + GET_SIZE(HDRP(next));
+        }
     }
-    newptr = malloc(size);
+
+    /* Absorb the free block after us and give back what we don't need */
+    if (avail >= asize) {
+        remove_free(next);
+        PUT(HDRP(oldptr), PACK(avail, 1 | GET_PREV_ALLOC(HDRP(oldptr))));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(oldptr)));
+        split_block(oldptr, asize);
+        return oldptr;
+    }
+
+    newptr = heap_alloc(asize);
 
     /* If realloc() fails the original block is left untouched  */
     if(!newptr) {
         return 0;
     }
 
-    /* Copy the old data. */
-    oldsize = *SIZE_PTR(oldptr);
+    /* Copy the old data (the payload excludes the header). */
+    oldsize -= WSIZE;
     if(size < oldsize) oldsize = size;
     memcpy(newptr, oldptr, oldsize);
 
     /* Free the old block. */
-    free(oldptr);
+    heap_free(oldptr);
 
     return newptr;
 }
@@ -343,12 +1084,18 @@ void mm_checkheap(int verbose) {
             fprintf(stderr, "blocks not aligned\n");
             exit(1);
         }
-        if (GET_SIZE(HDRP(b)) != GET_SIZE(FTRP(b)) ||
-            GET_ALLOC(HDRP(b)) != GET_ALLOC(FTRP(b))) {
+        /* only free blocks have a footer to compare against */
+        if (!GET_ALLOC(HDRP(b)) &&
+            (GET_SIZE(HDRP(b)) != GET_SIZE(FTRP(b)) || GET_ALLOC(FTRP(b)))) {
             fprintf(stderr, "header and footer don't match\n");
             exit(1);
 
         }
+        /* the next header must know whether we are allocated */
+        if (!GET_PREV_ALLOC(HDRP(next)) != !GET_ALLOC(HDRP(b))) {
+            fprintf(stderr, "prev-alloc flag doesn't match block\n");
+            exit(1);
+        }
         /* check for missing coalesces */
         if (!GET_ALLOC(HDRP(b)) && !GET_ALLOC(HDRP(next))) {
             fprintf(stderr, "Missing coalesces \n");
@@ -362,57 +1109,99 @@ void mm_checkheap(int verbose) {
 
     }
 
-    /* Check the small free list */
+    /* Check every segregated free list */
     int list_free_blocks = 0;
+    int c;
     char * fp;
-    for(fp = free_head; fp != 0; fp = NEXT_FREE_BLK(fp)) {
-        list_free_blocks += 1;
-        /* check to make sure pointers are in bounds */
-        if (fp > (char*)mem_heap_hi() || fp < (char*)mem_heap_lo()) {
-            fprintf(stderr, "list pointer out of bounds of heap");
+    for (c = 0; c < NUM_CLASSES; c++) {
+        /* the bitmap must agree with the list being empty or not */
+        if (((seg_bitmap >> c) & 1) != (seg_heads[c] != 0)) {
+            fprintf(stderr, "bitmap out of sync for class %d\n", c);
             exit(1);
         }
 
-        /* check for pointer bi-directionality matiching */
-        if(NEXT_FREE_BLK(fp) != 0) {
-            char * b = NEXT_FREE_BLK(fp);
-            char * b_prev = PREV_FREE_BLK(b);
-            if (fp != b_prev) {
-                fprintf(stderr, "next/prev pointers not consistent\n");
+        /* the biggest class is a tree, which has its own walk */
+        if (c == BIG_CLASS) {
+            list_free_blocks += check_tree(seg_heads[c], 0, 0);
+            continue;
+        }
+
+        for (fp = seg_heads[c]; fp != 0; fp = NEXT_FREE_BLK(fp)) {
+            list_free_blocks += 1;
+            /* check to make sure pointers are in bounds */
+            if (fp > (char*)mem_heap_hi() || fp < (char*)mem_heap_lo()) {
+                fprintf(stderr, "list pointer out of bounds of heap");
                 exit(1);
             }
-        }
-        if (GET_SIZE(HDRP(fp)) > BIG_SIZE) {
-              fprintf(stderr, "free block too large for small list");
-              exit(1);
-        }
 
+            /* check for pointer bi-directionality matiching */
+            if(NEXT_FREE_BLK(fp) != 0) {
+                char * b = NEXT_FREE_BLK(fp);
+                char * b_prev = PREV_FREE_BLK(b);
+                if (fp != b_prev) {
+                    fprintf(stderr, "next/prev pointers not consistent\n");
+                    exit(1);
+                }
+            }
 
-    }
-    /* checks the big free list */
-    for(fp = big_free_head; fp != 0; fp = NEXT_FREE_BLK(fp)) {
-        list_free_blocks += 1;
-        /* check to make sure pointers are in bounds */
-        if (fp > (char*)mem_heap_hi() || fp < (char*)mem_heap_lo()) {
-            fprintf(stderr, "free list pointer out of heap bounds");
-            exit(1);
-        }
+            /* sorted lists must stay sorted */
+            if (ADDR_ORDER && NEXT_FREE_BLK(fp) != 0 && NEXT_FREE_BLK(fp) < fp) {
+                fprintf(stderr, "free list out of address order\n");
+                exit(1);
+            }
 
-        /* check for pointer bi-directionality matiching */
-        if(NEXT_FREE_BLK(fp) != 0) {
-            char * b = NEXT_FREE_BLK(fp);
-            char * b_prev = PREV_FREE_BLK(b);
-            if (fp != b_prev) {
-                fprintf(stderr, "next/prev pointers not consistent\n");
+            /* check that the block sits in the list of its own class */
+            if (size_class(GET_SIZE(HDRP(fp))) != c) {
+                fprintf(stderr, "free block in the wrong size class\n");
                 exit(1);
             }
         }
-        if (GET_SIZE(HDRP(fp)) < BIG_SIZE) {
-              fprintf(stderr, "free block too small for big list");
-              exit(1);
+    }
+
+    /* Every skip list level is sorted and made of free blocks of its
+       class that are tall enough */
+    int l;
+    for (c = 0; ADDR_ORDER && c < BIG_CLASS; c++) {
+        for (l = 1; l < SKIP_LEVELS; l++) {
+            for (fp = skip_heads[c][l]; fp != 0; fp = SKIP_NEXT(fp, l)) {
+                if (GET_ALLOC(HDRP(fp)) || SKIP_HEIGHT(fp) < (unsigned int)l ||
+                    size_class(GET_SIZE(HDRP(fp))) != c ||
+                    (SKIP_NEXT(fp, l) != 0 && SKIP_NEXT(fp, l) < fp)) {
+                    fprintf(stderr, "bad skip list level %d in class %d\n",
+                            l, c);
+                    exit(1);
+                }
+            }
         }
+    }
 
+    /* Blocks waiting on the quick lists are allocated and of the size
+       of their list */
+    int fast_blocks = 0;
+    for (c = 0; c < FAST_CLASSES; c++) {
+        for (fp = fast_bins[c]; fp != 0; fp = FAST_NEXT(fp)) {
+            if (!GET_ALLOC(HDRP(fp)) ||
+                FAST_CLASS(GET_SIZE(HDRP(fp))) != c) {
+                fprintf(stderr, "bad block on quick list %d\n", c);
+                exit(1);
+            }
+            fast_blocks++;
+        }
+    }
+    if (fast_blocks != fast_total) {
+        fprintf(stderr, "quick list count out of sync\n");
+        exit(1);
+    }
 
+    /* Every slab with room is marked in the map and holds its class */
+    for (c = 0; c < SLAB_CLASSES; c++) {
+        for (fp = slab_heads[c]; fp != 0; fp = OFF_BLK(SLAB(fp)->next)) {
+            if (!is_slab(fp) || SLAB(fp)->size != (c + 1) * ALIGNMENT ||
+                SLAB_FULL(SLAB(fp))) {
+                fprintf(stderr, "bad slab in class %d\n", c);
+                exit(1);
+            }
+        }
     }
 
     /* Checks if the number of free blocks in the heap and in our lists are
@@ -426,253 +1215,859 @@ void mm_checkheap(int verbose) {
 
 }
 
+/*
+ * mm_profile - walks the heap and the free lists and fills in prof with
+ * the shape of the free space, along with the find_fit and coalesce
+ * counters gathered since mm_init
+ */
+void mm_profile(mm_profile_t *prof) {
+    char * b;
+    int c;
+
+    memset(prof, 0, sizeof(*prof));
+    LOCK_HEAP();
+
+    prof->heap_bytes = mem_heapsize();
+    for (b = NEXT_BLKP(heap_pointer); GET_SIZE(HDRP(b)) > 0; b = NEXT_BLKP(b)) {
+        size_t size = GET_SIZE(HDRP(b));
+        if (GET_ALLOC(HDRP(b))) {
+            continue;
+        }
+        prof->free_blocks++;
+        prof->free_bytes += size;
+        prof->largest_free = MAX(prof->largest_free, size);
+        prof->free_sizes[8 * sizeof(unsigned long) - 1 - __builtin_clzl(size)]++;
+    }
+    prof->ext_frag = prof->free_bytes == 0 ? 0 :
+        1.0 - (double)prof->largest_free / prof->free_bytes;
+
+    for (c = 0; c < BIG_CLASS; c++) {
+        for (b = seg_heads[c]; b != 0; b = NEXT_FREE_BLK(b)) {
+            prof->list_len[c]++;
+        }
+    }
+    prof->list_len[BIG_CLASS] = check_tree(seg_heads[BIG_CLASS], 0, 0);
+
+    memcpy(prof->fit_calls, fit_calls, sizeof(fit_calls));
+    memcpy(prof->fit_steps, fit_steps, sizeof(fit_steps));
+    memcpy(prof->coalesce, coalesce_cases, sizeof(coalesce_cases));
+    prof->extends = heap_extends;
+
+    UNLOCK_HEAP();
+}
 
 /*
- * Coalesces the blocks around the given plock pointer b
+ * Coalesces the blocks around the given plock pointer b. The block
+ * after the result is always told that its predecessor is now free.
 */
 static void * coalesce(void * b) {
 
   /* Check if the previous and next blocks are free */
-  size_t prev = GET_ALLOC(FTRP(PREV_BLKP(b)));
+  size_t prev = GET_PREV_ALLOC(HDRP(b));
   size_t next = GET_ALLOC(HDRP(NEXT_BLKP(b)));
+  size_t size = GET_SIZE(HDRP(b));
+
 
+  /* neither, next, prev, both: the same order as the cases below */
+  coalesce_cases[(!next) | (!prev) << 1]++;
 
   /* Both surrounding blocks are allocated, no need to coalesce */
   if (prev && next) {
-    /* Get the size of the current block */
-      size_t size = GET_SIZE(HDRP(b));
-      insert_free(b, size);
-      return b;
   }
   else if (prev && !next) {
-    /* Get the size of the current block */
-      size_t size = GET_SIZE(HDRP(b));
      /* add the size of the next block */
       size += GET_SIZE(HDRP(NEXT_BLKP(b)));
       /* remove the next block from the free list*/
       remove_free(NEXT_BLKP(b));
-      /* Use the current header and pack it with the new size */
-      PUT(HDRP(b), PACK(size, 0));
-      /* Macros automatically adjust footer */
-      PUT(FTRP(b), PACK(size, 0));
-
-      /* update the free list */
-      insert_free(b, size);
   }
   /* Coalesce with the previous block */
   else if (!prev && next) {
 
       /* Change the size */
-      /* Get the size of the current block */
-      size_t size = GET_SIZE(HDRP(b));
       size += GET_SIZE(HDRP(PREV_BLKP(b)));
       /* Go back to the previous block */
       b = PREV_BLKP(b);
 
       /* Remove the  previous block from the free list */
       remove_free(b);
-
-      /* Changes the header of the previous block */
-      PUT(HDRP(b), PACK(size, 0));
-      /* change the new footer of the previous block */
-      PUT(FTRP(b), PACK(size, 0));
-
-      /* update the free list */
-      insert_free(b, size);
   }
 
   else {
 
       /* Coalesce with both adjacent blocks */
-      /* Get the size of the current block */
-      size_t size = GET_SIZE(HDRP(b));
-      size += GET_SIZE(HDRP(PREV_BLKP(b))) + GET_SIZE(FTRP(NEXT_BLKP(b)));
-      /* remove_block(b); */
+      size += GET_SIZE(HDRP(PREV_BLKP(b))) + GET_SIZE(HDRP(NEXT_BLKP(b)));
 
       /* Remove the  previous block from the free list */
       remove_free(PREV_BLKP(b));
       /* remove the next block from the free list */
       remove_free(NEXT_BLKP(b));
 
-      /* Change the previous header and next footer */
-      PUT(HDRP(PREV_BLKP(b)), PACK(size, 0));
-      PUT(FTRP(NEXT_BLKP(b)), PACK(size, 0));
       b = PREV_BLKP(b);
+  }
 
-      /* update the free list */
-      insert_free(b, size);
-
+  /* Two free blocks are never adjacent, so whatever is before the
+     merged block is allocated. Macros automatically adjust footer. */
+  PUT(HDRP(b), PACK(size, PREV_ALLOC));
+  PUT(FTRP(b), PACK(size, 0));
+  CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(b)));
 
-  }
+  /* update the free list */
+  insert_free(b, size);
 
     return b;
 }
 
 
 /*
- * find_fit traverses the heap from the start and returns a pointer to the
- * first block of sufficient size that fits the memory size
+ * size_class - returns the index of the segregated list that holds
+ * free blocks of the given size
+ */
+static int size_class(size_t size) {
+    if (size > BIG_SIZE) {
+        return BIG_CLASS;
+    }
+    /* floor(log2(size)), shifted so that the smallest class is 0 */
+    return (int)(8 * sizeof(unsigned long) - 1 - __builtin_clzl(size))
+        - MIN_CLASS_SHIFT;
+}
+
+/*
+ * find_fit first does a first-fit scan of at most FIT_SCAN blocks of
+ * the size's own class. If nothing fits there, any block in a larger
+ * non-empty class is big enough, so the bitmap tells us which list head
+ * to return. Either way a lookup does a bounded amount of work, however
+ * many free blocks the heap holds. Large sizes (and small ones that end
+ * up in the tree) are best-fit.
  */
 
 static void * find_fit(size_t size) {
 
-    /* chose which seg list to traverse besed on size */
-    char * bp;
-    if (size > BIG_SIZE) {
-        bp = big_free_head;
-    }
-    else {
-        bp = free_head;
-    }
+    int c = size_class(size);
+    unsigned long * steps = &fit_steps[c];
+    int n;
 
+    fit_calls[c]++;
 
-    if (bp == 0) {
-        return NULL;
+    /* The biggest class has nothing larger above it */
+    if (c == BIG_CLASS) {
+        return tree_best_fit(size, steps);
     }
 
-    /* Loop the free list pointer */
-    while (bp != 0) {
+    /* Loop the first FIT_SCAN blocks of our own class */
+    char * bp;
+    for (bp = seg_heads[c], n = 0; bp != 0 && n < FIT_SCAN;
+            bp = NEXT_FREE_BLK(bp), n++) {
+        (*steps)++;
         if (size <= GET_SIZE(HDRP(bp))) {
             return bp;
         }
+    }
 
-        bp = NEXT_FREE_BLK(bp);
+    /* mask off our class and every class below it */
+    unsigned long above = seg_bitmap & (~0UL << (c + 1));
+    if (above == 0) {
+        return NULL;
     }
+    c = __builtin_ctzl(above);
+    if (c == BIG_CLASS) {
+        return tree_best_fit(size, steps);
+    }
+    (*steps)++;
+    return seg_heads[c];
+}
 
-    // printf("find finish null \n");
-    return NULL;
+/*
+ * allocates a block of size to b's location
+ */
+void place (void * b, size_t asize) {
+    size_t full_size = GET_SIZE(HDRP(b));
 
+    /* Explicit, so remove block from free list. This has to happen
+       before the header changes, since the size picks the list. */
+    remove_free(b);
 
-  }
+    /* Allocate the whole block, then give back whatever is left over */
+    PUT(HDRP(b), PACK(full_size, 1 | GET_PREV_ALLOC(HDRP(b))));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(b)));
+    split_block(b, asize);
+
+}
 
 /*
- * allocates a block of size to b's location
+ * split_block - shrinks the allocated block b down to asize bytes if the
+ * leftover is big enough to be a block of its own. The leftover is freed
+ * and coalesced with whatever follows it.
  */
-void place (void * b, size_t asize) {
+static void split_block(void * b, size_t asize) {
     size_t full_size = GET_SIZE(HDRP(b));
 
     if ((full_size - asize) >= HEADER_SIZE) {
 
         /* If enough space, split block */
-        PUT(HDRP(b), PACK(asize, 1));
-        PUT(FTRP(b), PACK(asize, 1));
-        /* Explicit, so remove block from free list */
-        remove_free(b);
+        PUT(HDRP(b), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(b))));
         /* move the pointer to the next block */
         b = NEXT_BLKP(b);
-        PUT(HDRP(b), PACK(full_size - asize, 0));
+        PUT(HDRP(b), PACK(full_size - asize, PREV_ALLOC));
         PUT(FTRP(b), PACK(full_size - asize, 0));
         coalesce(b);
-  }
-  else
-  {
-      /* Otherwise, don't split block and just allocate */
-      remove_free(b);
-      PUT(HDRP(b), PACK(full_size, 1));
-      PUT(FTRP(b), PACK(full_size, 1));
-  }
+    }
+    /* Otherwise, don't split block and keep the slack */
 
 }
 
 /*
- * insert_free - inserts b at head of free blocks list
+ * insert_free - inserts b at head of the free list for its size class,
+ * or with ADDR_ORDER, at its place by address
  */
 static void insert_free(void * b, size_t size)
 {
-      /* if we have a small insert size, use free_head */
-      if (size <= BIG_SIZE) {
-          if (free_head == 0 ) {
-              // printf("insert into empty\n");
-              free_head = b;
-              NEXT_FREE_BLK(b) = 0;
-              PREV_FREE_BLK(b) = 0;
-          }
+    int c = size_class(size);
+    if (c == BIG_CLASS) {
+        tree_insert(b, size);
+        return;
+    }
 
-          else {
-            // printf("insert into front\n");
-            PREV_FREE_BLK(free_head) = b;
-            PREV_FREE_BLK(b) = 0;
-            NEXT_FREE_BLK(b) = free_head;
+    if (ADDR_ORDER) {
+        char * pred[SKIP_LEVELS];
+        char * prev = skip_find(c, b, pred);
+        char * next = prev ? NEXT_FREE_BLK(prev) : seg_heads[c];
+        unsigned int h, l;
 
-            /* set the new head ptr */
-            free_head = b;
-          }
-     }
-     /* if we have a big insert size, use the big list.
-        It has the same process as the small size list */
-     else {
-         if (big_free_head == 0) {
-             big_free_head = b;
-             NEXT_FREE_BLK(b) = 0;
-             PREV_FREE_BLK(b) = 0;
-         }
+        /* the skip list got us close; walk the rest of the way */
+        while (next != 0 && next < (char *)b) {
+            prev = next;
+            next = NEXT_FREE_BLK(next);
+        }
+        SET_PREV_FREE(b, prev);
+        SET_NEXT_FREE(b, next);
+        if (prev != 0) {
+            SET_NEXT_FREE(prev, b);
+        } else {
+            seg_heads[c] = b;
+        }
+        if (next != 0) {
+            SET_PREV_FREE(next, b);
+        }
 
-         else {
-           PREV_FREE_BLK(big_free_head) = b;
-           PREV_FREE_BLK(b) = 0;
-           NEXT_FREE_BLK(b) = big_free_head;
-           big_free_head = b;
-         }
+        /* link the new block into the levels it is tall enough for */
+        if (size >= SKIP_MIN) {
+            h = skip_height(size);
+            SET_SKIP_HEIGHT(b, h);
+            for (l = 1; l <= h; l++) {
+                if (pred[l] != 0) {
+                    SET_SKIP_NEXT(b, l, SKIP_NEXT(pred[l], l));
+                    SET_SKIP_NEXT(pred[l], l, b);
+                } else {
+                    SET_SKIP_NEXT(b, l, skip_heads[c][l]);
+                    skip_heads[c][l] = b;
+                }
+            }
+        }
+        seg_bitmap |= 1UL << c;
+        return;
     }
 
+    char * head = seg_heads[c];
+
+    SET_PREV_FREE(b, 0);
+    SET_NEXT_FREE(b, head);
+    if (head != 0) {
+        SET_PREV_FREE(head, b);
+    }
+
+    /* set the new head ptr and mark the class as non-empty */
+    seg_heads[c] = b;
+    seg_bitmap |= 1UL << c;
 }
 
 /*
- * fremove_free - removes the block at b from the free list
+ * remove_free - removes the block at b from its size class free list
  */
 
 static void remove_free(void * b) {
+    int c = size_class(GET_SIZE(HDRP(b)));
+    if (c == BIG_CLASS) {
+        tree_remove(b);
+        return;
+    }
+
+    char * prev = PREV_FREE_BLK(b);
+    char * next = NEXT_FREE_BLK(b);
+
+    /* Remove the head of the list, or unlink from the middle */
+    if (prev == 0) {
+        seg_heads[c] = next;
+        /* the list just became empty */
+        if (next == 0) {
+            seg_bitmap &= ~(1UL << c);
+        }
+    }
+    else {
+        SET_NEXT_FREE(prev, next);
+    }
+
+    if (next != 0) {
+        SET_PREV_FREE(next, prev);
+    }
+
+    /* unlink from the skip list levels above the list, if any */
+    unsigned int l, h = ADDR_ORDER ? SKIP_HEIGHT(b) : 0;
+    if (h > 0) {
+        char * pred[SKIP_LEVELS];
+        skip_find(c, b, pred);
+        for (l = 1; l <= h; l++) {
+            if (pred[l] != 0) {
+                SET_SKIP_NEXT(pred[l], l, SKIP_NEXT(b, l));
+            } else {
+                skip_heads[c][l] = SKIP_NEXT(b, l);
+            }
+        }
+    }
+}
+
+/*
+ * skip_find - searches the skip list of class c from the top level down
+ * for the last block below b on each level, and stores it in pred[l]
+ * (0 if there is none). Returns pred[1], which is where a walk of the
+ * list itself can start.
+ */
+static char *skip_find(int c, char * b, char ** pred) {
+    char * x = 0;
+    char * next;
+    int l;
+
+    for (l = SKIP_LEVELS - 1; l >= 1; l--) {
+        next = x ? SKIP_NEXT(x, l) : skip_heads[c][l];
+        while (next != 0 && next < b) {
+            x = next;
+            next = SKIP_NEXT(x, l);
+        }
+        pred[l] = x;
+    }
+    return x;
+}
+
+/*
+ * skip_height - picks the skip list height of a new free block of the
+ * given size: each level is kept with probability 1/4, up to as many
+ * links as fit in the block
+ */
+static unsigned int skip_height(size_t size) {
+    unsigned int h = 0;
+    unsigned int room = MIN(SKIP_ROOM(size), SKIP_LEVELS - 1);
+
+    /* xorshift32 */
+    skip_seed ^= skip_seed << 13;
+    skip_seed ^= skip_seed >> 17;
+    skip_seed ^= skip_seed << 5;
+
+    unsigned int r = skip_seed;
+    while (h < room && (r & 3) == 0) {
+        h++;
+        r >>= 2;
+    }
+    return h;
+}
+
+/*
+ * tree_splay - top-down splay of the tree rooted at t around the key
+ * (size, addr). Returns the new root, which is the node with that key if
+ * there is one, and otherwise a neighbor of where it would go.
+ */
+static char *tree_splay(char * t, size_t size, char * addr) {
+    /* tails (and heads) of the trees of nodes left and right of the key */
+    char * l_head = 0;
+    char * l_tail = 0;
+    char * r_head = 0;
+    char * r_tail = 0;
+    char * y;
+
+    for (;;) {
+        if (KEY_LESS(size, addr, t)) {
+            if ((y = TREE_LEFT(t)) == 0) {
+                break;
+            }
+            /* rotate right */
+            if (KEY_LESS(size, addr, y)) {
+                SET_TREE_LEFT(t, TREE_RIGHT(y));
+                SET_TREE_RIGHT(y, t);
+                t = y;
+                if (TREE_LEFT(t) == 0) {
+                    break;
+                }
+            }
+            /* link t into the right tree */
+            if (r_tail != 0) {
+                SET_TREE_LEFT(r_tail, t);
+            }
+            else {
+                r_head = t;
+            }
+            r_tail = t;
+            t = TREE_LEFT(t);
+        }
+        else if (t != addr) {
+            if ((y = TREE_RIGHT(t)) == 0) {
+                break;
+            }
+            /* rotate left */
+            if (!KEY_LESS(size, addr, y) && y != addr) {
+                SET_TREE_RIGHT(t, TREE_LEFT(y));
+                SET_TREE_LEFT(y, t);
+                t = y;
+                if (TREE_RIGHT(t) == 0) {
+                    break;
+                }
+            }
+            /* link t into the left tree */
+            if (l_tail != 0) {
+                SET_TREE_RIGHT(l_tail, t);
+            }
+            else {
+                l_head = t;
+            }
+            l_tail = t;
+            t = TREE_RIGHT(t);
+        }
+        else {
+            break;
+        }
+    }
+
+    /* reassemble the left tree, t, and the right tree */
+    if (l_tail != 0) {
+        SET_TREE_RIGHT(l_tail, TREE_LEFT(t));
+        SET_TREE_LEFT(t, l_head);
+    }
+    if (r_tail != 0) {
+        SET_TREE_LEFT(r_tail, TREE_RIGHT(t));
+        SET_TREE_RIGHT(t, r_head);
+    }
+    return t;
+}
+
+/*
+ * tree_insert - adds the free block b of the given size to the tree
+ */
+static void tree_insert(char * b, size_t size) {
+    char * t = seg_heads[BIG_CLASS];
+
+    if (t == 0) {
+        SET_TREE_LEFT(b, 0);
+        SET_TREE_RIGHT(b, 0);
+    }
+    else {
+        /* splay the neighbor of b to the root and put b above it */
+        t = tree_splay(t, size, b);
+        if (KEY_LESS(size, b, t)) {
+            SET_TREE_LEFT(b, TREE_LEFT(t));
+            SET_TREE_RIGHT(b, t);
+            SET_TREE_LEFT(t, 0);
+        }
+        else {
+            SET_TREE_RIGHT(b, TREE_RIGHT(t));
+            SET_TREE_LEFT(b, t);
+            SET_TREE_RIGHT(t, 0);
+        }
+    }
+    seg_heads[BIG_CLASS] = b;
+    seg_bitmap |= 1UL << BIG_CLASS;
+}
+
+/*
+ * tree_remove - removes the free block b from the tree
+ */
+static void tree_remove(char * b) {
     size_t size = GET_SIZE(HDRP(b));
-    /* remove from the small list if size less than the cutoff */
-    if (size <= BIG_SIZE) {
-        /* list empty */
-        if (free_head == 0) {
-            /* printf("no free blocks to allocate small \n" ); */
-            return;
-        }
-        /* list only has one element */
-        else if (PREV_FREE_BLK(b) == 0 && NEXT_FREE_BLK(b) == 0) {
-            free_head = 0;
-            // printf("one element list, remove\n");
-        }
-        /* Remove the head of the list*/
-        else if (PREV_FREE_BLK(b) == 0) {
-            PREV_FREE_BLK(NEXT_FREE_BLK(b)) = 0;
-            free_head = NEXT_FREE_BLK(b);
-        }
-        /* remove tail of list */
-        else if (NEXT_FREE_BLK(b) == 0) {
-            /* removing the last point in the list */
-            NEXT_FREE_BLK(PREV_FREE_BLK(b)) = 0;
-        }
-        /* take from middle of list */
+    char * t = tree_splay(seg_heads[BIG_CLASS], size, b);
+    char * root;
+
+    /* b is now the root. Join its subtrees: every key on the left is
+       smaller than b, so splaying for b there brings up the maximum. */
+    if (TREE_LEFT(t) == 0) {
+        root = TREE_RIGHT(t);
+    }
+    else {
+        root = tree_splay(TREE_LEFT(t), size, b);
+        SET_TREE_RIGHT(root, TREE_RIGHT(t));
+    }
+
+    seg_heads[BIG_CLASS] = root;
+    if (root == 0) {
+        seg_bitmap &= ~(1UL << BIG_CLASS);
+    }
+}
+
+/*
+ * tree_best_fit - returns the smallest free block in the tree of at
+ * least size bytes, or NULL. The caller is about to remove it, which
+ * splays it to the top, so this walk does not restructure the tree.
+ * Every node visited is added to *steps.
+ */
+static char *tree_best_fit(size_t size, unsigned long * steps) {
+    char * best = 0;
+    char * t = seg_heads[BIG_CLASS];
+
+    while (t != 0) {
+        (*steps)++;
+        if (GET_SIZE(HDRP(t)) >= size) {
+            best = t;
+            t = TREE_LEFT(t);
+        }
         else {
-            // adjust the previous and next
-            PREV_FREE_BLK(NEXT_FREE_BLK(b)) = PREV_FREE_BLK(b);
-            NEXT_FREE_BLK(PREV_FREE_BLK(b)) = NEXT_FREE_BLK(b);
+            t = TREE_RIGHT(t);
+        }
+    }
+    return best;
+}
+
+/*
+ * check_tree - verifies that the subtree rooted at t is ordered, stays
+ * strictly between the nodes lo and hi (either may be NULL), and only
+ * holds big free blocks. Returns the number of nodes in it.
+ */
+static int check_tree(char * t, char * lo, char * hi) {
+    if (t == 0) {
+        return 0;
+    }
+    if (t > (char*)mem_heap_hi() || t < (char*)mem_heap_lo()) {
+        fprintf(stderr, "tree pointer out of heap bounds");
+        exit(1);
+    }
+    if (GET_ALLOC(HDRP(t)) || size_class(GET_SIZE(HDRP(t))) != BIG_CLASS) {
+        fprintf(stderr, "tree node is not a big free block\n");
+        exit(1);
+    }
+    if ((lo != 0 && !KEY_LESS(GET_SIZE(HDRP(lo)), lo, t)) ||
+        (hi != 0 && !KEY_LESS(GET_SIZE(HDRP(t)), t, hi))) {
+        fprintf(stderr, "tree nodes out of order\n");
+        exit(1);
+    }
+    return 1 + check_tree(TREE_LEFT(t), lo, t) + check_tree(TREE_RIGHT(t), t, hi);
+}
+
+/*
+ * is_slab - whether ptr points into a slab rather than at a heap block
+ * or a mapping. A slab fills its SLAB_SIZE bytes, so no other payload
+ * can start inside them.
+ */
+static int is_slab(void * ptr) {
+    size_t off = (char *)ptr - heap_base;
+
+    if (SLAB_MAX == 0 || (char *)ptr < heap_base || off >= mem_heapsize()) {
+        return 0;
+    }
+    off /= SLAB_SIZE;
+    return (slab_map[off / 64] >> (off % 64)) & 1;
+}
 
+/*
+ * slab_alloc - hand out an object for a request of at most SLAB_MAX
+ * bytes from the first slab of its class with room, making a new slab
+ * if there is none. Returns NULL if the class has too few live blocks
+ * to fill a slab yet, or if the heap is out of memory.
+ */
+static void *slab_alloc(size_t size) {
+    int c = SLAB_CLASS(size);
+    char * s = slab_heads[c];
+    slab_t * sl;
+    char * obj;
+
+    if (s == NULL) {
+        if (small_live[SLAB_HEAP_SIZE(c) / ALIGNMENT] < SLAB_OBJECTS(c) ||
+            (s = slab_new(c)) == NULL) {
+            return NULL;
         }
     }
+    sl = SLAB(s);
+
+    /* reuse a freed object, or else carve the next untouched one */
+    if (sl->free != 0) {
+        obj = s + sl->free;
+        sl->free = *(unsigned short *)obj;
+    }
     else {
-        /* do the same thing with the big size free list */
-        if (big_free_head == 0) {
-            /* printf("no free blocks to allocate \n" ); */
-            return;
+        obj = s + sl->carved;
+        sl->carved += sl->size;
+    }
+    sl->used++;
+
+    if (SLAB_FULL(sl)) {
+        slab_unlink(s, c);
+    }
+    return obj;
+}
+
+/*
+ * slab_free - put obj back on its slab's free list. A slab that becomes
+ * empty goes back to the heap, unless it is the only slab of its class
+ * with room, which keeps one ready for the next request.
+ */
+static void slab_free(void * obj) {
+    char * s = SLAB_OF(obj);
+    slab_t * sl = SLAB(s);
+    int c = SLAB_CLASS(sl->size);
+
+    if (SLAB_FULL(sl)) {
+        slab_link(s, c);
+    }
+    *(unsigned short *)obj = sl->free;
+    sl->free = (char *)obj - s;
+    sl->used--;
+
+    if (sl->used == 0 && (slab_heads[c] != s || sl->next != 0)) {
+        size_t bit = SLAB_BIT(s);
+        slab_unlink(s, c);
+        slab_map[bit / 64] &= ~(1UL << (bit % 64));
+        heap_free(s);
+    }
+}
+
+/*
+ * slab_new - make an empty slab for class c. A heap block is allocated
+ * with room for a SLAB_SIZE-aligned slab anywhere in it; the slab
+ * becomes a block of its own and the pieces before and after it are
+ * freed again.
+ */
+static char *slab_new(int c) {
+    char * b = heap_alloc(2 * SLAB_SIZE + HEADER_SIZE);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    /* the leading piece, if any, must be big enough to be a block */
+    char * s = SLAB_OF(b);
+    if (s != b) {
+        s += SLAB_SIZE;
+        if (s - b < HEADER_SIZE) {
+            s += SLAB_SIZE;
         }
-        else if (PREV_FREE_BLK(b) == 0 && NEXT_FREE_BLK(b) == 0) {
-            big_free_head = 0;
+    }
+
+    if (s != b) {
+        size_t size = GET_SIZE(HDRP(b));
+        PUT(HDRP(b), PACK(s - b, 1 | GET_PREV_ALLOC(HDRP(b))));
+        PUT(HDRP(s), PACK(size - (s - b), 1 | PREV_ALLOC));
+        heap_free(b);
+    }
+    split_block(s, SLAB_BLOCK);
+
+    slab_t * sl = SLAB(s);
+    sl->free = 0;
+    sl->carved = SLAB_FIRST;
+    sl->size = (c + 1) * ALIGNMENT;
+    sl->used = 0;
+    slab_link(s, c);
+
+    size_t bit = SLAB_BIT(s);
+    slab_map[bit / 64] |= 1UL << (bit % 64);
+    return s;
+}
+
+/*
+ * count_small - add n to the live count of bp's size, if it is a heap
+ * block small enough to have been a slab object
+ */
+static void count_small(void * bp, int n) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (SLAB_MAX > 0 && size <= SMALL_BLOCK_MAX) {
+        small_live[size / ALIGNMENT] += n;
+    }
+}
+
+/*
+ * slab_link/slab_unlink - add s to (or take it off) the front of the
+ * list of slabs of class c that have room
+ */
+static void slab_link(char * s, int c) {
+    char * head = slab_heads[c];
+
+    SLAB(s)->prev = 0;
+    SLAB(s)->next = BLK_OFF(head);
+    if (head != 0) {
+        SLAB(head)->prev = BLK_OFF(s);
+    }
+    slab_heads[c] = s;
+}
+
+static void slab_unlink(char * s, int c) {
+    char * prev = OFF_BLK(SLAB(s)->prev);
+    char * next = OFF_BLK(SLAB(s)->next);
+
+    if (prev == 0) {
+        slab_heads[c] = next;
+    }
+    else {
+        SLAB(prev)->next = BLK_OFF(next);
+    }
+    if (next != 0) {
+        SLAB(next)->prev = BLK_OFF(prev);
+    }
+}
+
+#ifdef MM_THREADS
+/*
+ * tcache_setup - one-time setup of the central list locks and the key
+ * whose destructor hands a dying thread's cache back
+ */
+static void tcache_setup(void) {
+    int c;
+    for (c = 0; c < TCACHE_CLASSES; c++) {
+        pthread_mutex_init(&central[c].lock, NULL);
+    }
+    pthread_key_create(&tcache_key, tcache_release);
+}
+
+/*
+ * get_tcache - returns this thread's cache, emptying it first if it
+ * belongs to an earlier heap generation
+ */
+static tcache_t * get_tcache(void) {
+    if (tcache.generation != heap_generation) {
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.generation = heap_generation;
+        pthread_setspecific(tcache_key, &tcache);
+    }
+    return &tcache;
+}
+
+/*
+ * tcache_alloc - pops a block of exactly asize bytes from this thread's
+ * cache, refilling the bin first if it is empty. Returns NULL if the
+ * shared heap could not provide one either.
+ */
+static void *tcache_alloc(size_t asize) {
+    tcache_t * tc = get_tcache();
+    int c = TCLASS(asize);
+
+    if (tc->bins[c] == 0) {
+        tcache_refill(tc, c, asize);
+    }
+
+    char * bp = tc->bins[c];
+    if (bp != 0) {
+        tc->bins[c] = CACHE_NEXT(bp);
+        tc->count[c]--;
+    }
+    return bp;
+}
+
+/*
+ * tcache_free - pushes a small block of the given size onto this
+ * thread's cache and hands a batch to the central list if the bin grows
+ * past TCACHE_LIMIT.
+ */
+static void tcache_free(void * bp, size_t size) {
+    tcache_t * tc = get_tcache();
+    int c = TCLASS(size);
+
+    CACHE_NEXT(bp) = tc->bins[c];
+    tc->bins[c] = bp;
+    if (++tc->count[c] > TCACHE_LIMIT) {
+        tcache_flush(tc, c, TCACHE_BATCH);
+    }
+}
+
+/*
+ * tcache_refill - moves up to TCACHE_BATCH blocks of bin c from the
+ * central list into tc. If the central list is empty, a batch is carved
+ * out of the backing heap instead.
+ */
+static void tcache_refill(tcache_t * tc, int c, size_t asize) {
+    central_t * cl = &central[c];
+    char * bp;
+    int i;
+
+    pthread_mutex_lock(&cl->lock);
+    while (cl->head != 0 && tc->count[c] < TCACHE_BATCH) {
+        bp = cl->head;
+        cl->head = CACHE_NEXT(bp);
+        cl->count--;
+        CACHE_NEXT(bp) = tc->bins[c];
+        tc->bins[c] = bp;
+        tc->count[c]++;
+    }
+    pthread_mutex_unlock(&cl->lock);
+
+    if (tc->bins[c] != 0) {
+        return;
+    }
+
+    LOCK_HEAP();
+    for (i = 0; i < TCACHE_BATCH; i++) {
+        if ((bp = heap_alloc(asize)) == NULL) {
+            break;
         }
-        else if (PREV_FREE_BLK(b) == 0) {
-            PREV_FREE_BLK(NEXT_FREE_BLK(b)) = 0;
-            big_free_head = NEXT_FREE_BLK(b);
+        /* place() may leave a little slack, so bin by the real size */
+        size_t size = GET_SIZE(HDRP(bp));
+        if (size > TCACHE_MAX) {
+            heap_free(bp);
+            continue;
         }
-        else if (NEXT_FREE_BLK(b) == 0) {
-            NEXT_FREE_BLK(PREV_FREE_BLK(b)) = 0;
+        CACHE_NEXT(bp) = tc->bins[TCLASS(size)];
+        tc->bins[TCLASS(size)] = bp;
+        tc->count[TCLASS(size)]++;
+    }
+    UNLOCK_HEAP();
+}
+
+/*
+ * tcache_flush - moves n blocks of bin c from tc to the central list.
+ * If that pushes the central list past CENTRAL_LIMIT, a batch of its
+ * blocks is really freed into the backing heap.
+ */
+static void tcache_flush(tcache_t * tc, int c, int n) {
+    central_t * cl = &central[c];
+    char * excess = 0;
+    char * bp;
+
+    pthread_mutex_lock(&cl->lock);
+    while (n-- > 0 && tc->bins[c] != 0) {
+        bp = tc->bins[c];
+        tc->bins[c] = CACHE_NEXT(bp);
+        tc->count[c]--;
+        CACHE_NEXT(bp) = cl->head;
+        cl->head = bp;
+        cl->count++;
+    }
+    if (cl->count > CENTRAL_LIMIT) {
+        /* detach the first TCACHE_BATCH blocks to return to the heap */
+        int i;
+        excess = cl->head;
+        for (bp = excess, i = 1; i < TCACHE_BATCH; i++) {
+            bp = CACHE_NEXT(bp);
         }
-        else {
-            PREV_FREE_BLK(NEXT_FREE_BLK(b)) = PREV_FREE_BLK(b);
-            NEXT_FREE_BLK(PREV_FREE_BLK(b)) = NEXT_FREE_BLK(b);
+        cl->head = CACHE_NEXT(bp);
+        cl->count -= TCACHE_BATCH;
+        CACHE_NEXT(bp) = 0;
+    }
+    pthread_mutex_unlock(&cl->lock);
+
+    if (excess != 0) {
+        LOCK_HEAP();
+        while (excess != 0) {
+            bp = excess;
+            excess = CACHE_NEXT(bp);
+            heap_free(bp);
         }
+        UNLOCK_HEAP();
+    }
+}
 
+/*
+ * tcache_release - thread exit destructor that hands every cached block
+ * to the central lists, so other threads can reuse them
+ */
+static void tcache_release(void * arg) {
+    tcache_t * tc = arg;
+    int c;
+
+    if (tc->generation != heap_generation) {
+        return;
+    }
+    for (c = 0; c < TCACHE_CLASSES; c++) {
+        tcache_flush(tc, c, tc->count[c]);
     }
 }
+#endif /* def MM_THREADS */
@@ -23,3 +23,28 @@ extern int mm_init(void);
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
 extern void mm_checkheap(int verbose);
+
+/* Shape of the heap and of the free lists, filled in by mm_profile.
+   The find_fit, coalesce and extends counts cover everything since
+   mm_init. */
+#define MM_PROF_SIZES   32  /* free block size histogram: floor(log2) */
+#define MM_PROF_CLASSES 15  /* segregated size classes, the last is big */
+
+typedef struct {
+	size_t heap_bytes;                      /* current heap size */
+	size_t free_bytes;                      /* bytes in free blocks */
+	size_t largest_free;                    /* biggest free block */
+	double ext_frag;                        /* 1 - largest / free bytes */
+	unsigned long free_blocks;              /* number of free blocks */
+	unsigned long free_sizes[MM_PROF_SIZES];/* free blocks by log2 size */
+	unsigned long list_len[MM_PROF_CLASSES];/* free blocks in each class */
+	unsigned long fit_calls[MM_PROF_CLASSES];/* find_fit calls by class
+	                                           of the request ... */
+	unsigned long fit_steps[MM_PROF_CLASSES];/* ... and free blocks they
+	                                           looked at */
+	unsigned long coalesce[4];              /* neither neighbor free,
+	                                           next, prev, both */
+	unsigned long extends;                  /* times malloc grew the heap */
+} mm_profile_t;
+
+extern void mm_profile(mm_profile_t *prof);
@@ -0,0 +1,459 @@
+/*
+ * mtrace.c - record the malloc traffic of an unmodified program as a
+ * malloc lab trace
+ *
+ * usage: LD_PRELOAD=./libmtrace.so MTRACE_FILE=out.rep <program> ...
+ *
+ * malloc, calloc, realloc and free are interposed and passed on to the
+ * C library; each call is also logged with its pointers and size. When
+ * the program exits the log is turned into a trace: every allocated
+ * pointer gets a block id (ids are reused once freed), and the requests
+ * are written as a .rep file, or as a binary trace if MTRACE_FILE ends
+ * in ".bin". A "%p" in MTRACE_FILE is replaced by the process id, so a
+ * program that runs others gets one trace per process. The default
+ * file is mtrace.rep.
+ *
+ * Recording is meant to stay out of the program's way. Each thread
+ * logs into a buffer of its own, taken from mmap rather than malloc,
+ * and no lock is ever taken: the only shared writes are one atomic
+ * increment per call, which orders the calls of all threads, and a
+ * compare-and-swap when a thread links a new buffer into the list of
+ * all buffers. The log is sorted and turned into a trace only at exit.
+ *
+ * Calls the driver can't replay are left out: zero-byte requests, and
+ * frees and reallocs of pointers that were allocated before recording
+ * started (a realloc of one of those is written as a new alloc). Memory
+ * from posix_memalign and friends is not interposed, so its frees are
+ * left out too.
+ */
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "tracefmt.h"
+
+/* the C library's own allocator, under the names glibc exports it by */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/* mdriver's overlap check is linear in the live blocks, so bigger
+   traces are always marked ignore-ranges (as tracegen does) */
+#define RANGE_CHECK_MAX 100000
+
+#define MAXNAME 4096
+
+/* One logged call. A realloc that moves its block is logged twice: an
+   UNBIND of the old pointer, numbered before the call (nothing else can
+   get that address until the call frees it), and the REALLOC itself,
+   numbered after it returns. */
+enum { REC_ALLOC, REC_FREE, REC_REALLOC, REC_UNBIND };
+
+typedef struct {
+	unsigned long seq;      /* position in the order of all calls */
+	void *ptr;              /* block allocated, freed or reallocated */
+	void *old;              /* realloc: the block it was called with */
+	size_t size;
+	int type;               /* REC_xxx */
+} rec_t;
+
+/* A thread's log is a list of buffers; every buffer of every thread is
+   also on one global list */
+#define BUF_RECS 8192
+
+typedef struct buf {
+	struct buf *next;       /* in the global list */
+	long n;                 /* records used (only the owner writes it) */
+	rec_t recs[BUF_RECS];
+} buf_t;
+
+static buf_t *all_bufs;             /* pushed with compare-and-swap */
+static unsigned long next_seq;      /* taken with an atomic increment */
+static int recording;               /* set by the constructor */
+static pid_t owner_pid;
+
+static __thread buf_t *my_buf;      /* the thread's current buffer */
+static __thread int in_mtrace;      /* don't log our own calls */
+
+static void record(int type, void *ptr, void *old, size_t size,
+		unsigned long seq);
+static unsigned long take_seq(void);
+static void write_trace(void);
+
+__attribute__((constructor))
+static void mtrace_start(void)
+{
+	owner_pid = getpid();
+	__atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+}
+
+__attribute__((destructor))
+static void mtrace_stop(void)
+{
+	__atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+	/* a forked child has a copy of its parent's log; only the process
+	   that loaded us writes it */
+	if (getpid() != owner_pid)
+		return;
+	in_mtrace = 1;
+	write_trace();
+}
+
+/*
+ * The interposed allocator. Each call goes to the C library first, then
+ * is logged, except that a free is numbered before its block is given
+ * back, so the block's next owner is always numbered after it.
+ */
+void *malloc(size_t size)
+{
+	void *p = __libc_malloc(size);
+
+	if (p != NULL && size > 0)
+		record(REC_ALLOC, p, NULL, size, take_seq());
+	return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *p = __libc_calloc(nmemb, size);
+
+	if (p != NULL && nmemb * size > 0)
+		record(REC_ALLOC, p, NULL, nmemb * size, take_seq());
+	return p;
+}
+
+void free(void *ptr)
+{
+	if (ptr != NULL)
+		record(REC_FREE, ptr, NULL, 0, take_seq());
+	__libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	unsigned long before;
+	void *p;
+
+	if (ptr == NULL)
+		return malloc(size);
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	before = take_seq();
+	if ((p = __libc_realloc(ptr, size)) == NULL)
+		return NULL;
+	if (p != ptr)
+		record(REC_UNBIND, ptr, NULL, 0, before);
+	record(REC_REALLOC, p, ptr, size, take_seq());
+	return p;
+}
+
+/*
+ * take_seq - number the next call in the order of all threads' calls
+ */
+static unsigned long take_seq(void)
+{
+	return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * record - append one call to the thread's log, starting a new buffer
+ *     when the current one is full
+ */
+static void record(int type, void *ptr, void *old, size_t size,
+		unsigned long seq)
+{
+	buf_t *b = my_buf;
+	rec_t *r;
+
+	if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE) || in_mtrace)
+		return;
+
+	if (b == NULL || b->n == BUF_RECS) {
+		b = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (b == MAP_FAILED)
+			return;
+		b->n = 0;
+		b->next = __atomic_load_n(&all_bufs, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&all_bufs, &b->next, b, 0,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		my_buf = b;
+	}
+
+	r = &b->recs[b->n];
+	r->seq = seq;
+	r->type = type;
+	r->ptr = ptr;
+	r->old = old;
+	r->size = size;
+	/* publish the record before the count that covers it */
+	__atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * The pointer -> block id maps used while the log is turned into a
+ * trace: open addressing, keyed by address, with deleted slots marked
+ */
+typedef struct {
+	void *ptr;              /* NULL: empty, DELETED: was used */
+	int id;
+} slot_t;
+
+typedef struct {
+	slot_t *slots;
+	size_t size, used;      /* used counts deleted slots as well */
+} map_t;
+
+#define DELETED ((void *)1)
+
+static size_t hash_ptr(const map_t *m, void *p)
+{
+	unsigned long x = (unsigned long)p;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	return x & (m->size - 1);
+}
+
+static slot_t *map_find(const map_t *m, void *p)
+{
+	size_t i;
+
+	for (i = hash_ptr(m, p); m->slots[i].ptr != NULL; i = (i + 1) & (m->size - 1))
+		if (m->slots[i].ptr == p)
+			return &m->slots[i];
+	return NULL;
+}
+
+static void map_put(map_t *m, void *p, int id);
+
+/*
+ * map_grow - rehash the map into a table four times the size of its
+ *     live entries, which drops the deleted ones
+ */
+static void map_grow(map_t *m)
+{
+	slot_t *old = m->slots;
+	size_t i, n = m->size, live = 0;
+
+	for (i = 0; i < n; i++)
+		if (old[i].ptr != NULL && old[i].ptr != DELETED)
+			live++;
+	for (m->size = 1024; m->size < 4 * live; m->size *= 2)
+		;
+	m->slots = __libc_calloc(m->size, sizeof(slot_t));
+	if (m->slots == NULL) {
+		fprintf(stderr, "mtrace: out of memory\n");
+		exit(1);
+	}
+	m->used = 0;
+	for (i = 0; i < n; i++)
+		if (old[i].ptr != NULL && old[i].ptr != DELETED)
+			map_put(m, old[i].ptr, old[i].id);
+	__libc_free(old);
+}
+
+static void map_put(map_t *m, void *p, int id)
+{
+	size_t i;
+
+	if (2 * (m->used + 1) > m->size)
+		map_grow(m);
+	for (i = hash_ptr(m, p); m->slots[i].ptr != NULL &&
+			m->slots[i].ptr != DELETED; i = (i + 1) & (m->size - 1))
+		;
+	if (m->slots[i].ptr == NULL)
+		m->used++;
+	m->slots[i].ptr = p;
+	m->slots[i].id = id;
+}
+
+/*
+ * map_take - remove p from the map and return its id, or -1 if it
+ *     isn't there
+ */
+static int map_take(map_t *m, void *p)
+{
+	slot_t *s = map_find(m, p);
+
+	if (s == NULL)
+		return -1;
+	s->ptr = DELETED;
+	return s->id;
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+	const rec_t *x = a, *y = b;
+
+	return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/*
+ * write_trace - gather every thread's log, put the calls in order, give
+ *     the blocks ids, and write the trace to MTRACE_FILE
+ */
+static void write_trace(void)
+{
+	const char *spec = getenv("MTRACE_FILE");
+	char name[MAXNAME];
+	map_t live = { NULL, 0, 0 };    /* block -> id */
+	map_t moving = { NULL, 0, 0 };  /* old block of a moving realloc -> id */
+	buf_t *b;
+	rec_t *recs;
+	traceop_t *ops;
+	int *free_ids;
+	long n = 0, i, num_ops = 0;
+	int id, num_ids = 0, num_free = 0, binary;
+	FILE *out;
+
+	if (spec == NULL || *spec == '\0')
+		spec = "mtrace.rep";
+	for (i = 0; *spec != '\0' && i < MAXNAME - 24; spec++) {
+		if (spec[0] == '%' && spec[1] == 'p') {
+			i += sprintf(name + i, "%d", (int)owner_pid);
+			spec++;
+		} else {
+			name[i++] = *spec;
+		}
+	}
+	name[i] = '\0';
+	binary = (i > 4 && strcmp(name + i - 4, ".bin") == 0);
+
+	for (b = all_bufs; b != NULL; b = b->next)
+		n += __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+	recs = __libc_malloc((n ? n : 1) * sizeof(rec_t));
+	ops = __libc_malloc((n ? n : 1) * sizeof(traceop_t));
+	free_ids = __libc_malloc((n ? n : 1) * sizeof(int));
+	if (recs == NULL || ops == NULL || free_ids == NULL) {
+		fprintf(stderr, "mtrace: out of memory\n");
+		return;
+	}
+	n = 0;
+	for (b = all_bufs; b != NULL; b = b->next) {
+		long m = __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+		memcpy(recs + n, b->recs, m * sizeof(rec_t));
+		n += m;
+	}
+	qsort(recs, n, sizeof(rec_t), cmp_seq);
+
+	map_grow(&live);
+	map_grow(&moving);
+	for (i = 0; i < n; i++) {
+		rec_t *r = &recs[i];
+		traceop_t *op = &ops[num_ops];
+
+		switch (r->type) {
+			case REC_ALLOC:
+				if (r->size > INT_MAX)
+					break;    /* too big to replay */
+				id = num_free > 0 ? free_ids[--num_free] : num_ids++;
+				map_put(&live, r->ptr, id);
+				op->type = ALLOC;
+				op->index = id;
+				op->size = r->size;
+				num_ops++;
+				break;
+
+			case REC_UNBIND:
+				/* the block's address is free for others until the
+				   realloc it is moving in returns */
+				if ((id = map_take(&live, r->ptr)) >= 0)
+					map_put(&moving, r->ptr, id);
+				break;
+
+			case REC_REALLOC:
+				if (r->ptr == r->old)
+					id = map_take(&live, r->ptr);
+				else
+					id = map_take(&moving, r->old);
+				if (r->size > INT_MAX) {
+					/* too big to replay; end the block here */
+					if (id >= 0) {
+						op->type = FREE;
+						op->index = id;
+						op->size = 0;
+						num_ops++;
+						free_ids[num_free++] = id;
+					}
+					break;
+				}
+				/* a block from before recording started is new to us */
+				op->type = REALLOC;
+				if (id < 0) {
+					id = num_free > 0 ? free_ids[--num_free] : num_ids++;
+					op->type = ALLOC;
+				}
+				map_put(&live, r->ptr, id);
+				op->index = id;
+				op->size = r->size;
+				num_ops++;
+				break;
+
+			case REC_FREE:
+				if ((id = map_take(&live, r->ptr)) < 0)
+					break;
+				op->type = FREE;
+				op->index = id;
+				op->size = 0;
+				num_ops++;
+				free_ids[num_free++] = id;
+				break;
+		}
+	}
+	if (num_ops > INT_MAX) {
+		fprintf(stderr, "mtrace: too many requests for one trace\n");
+		return;
+	}
+
+	if ((out = fopen(name, "w")) == NULL) {
+		fprintf(stderr, "mtrace: could not create %s\n", name);
+		return;
+	}
+	if (binary) {
+		tracehdr_t hdr;
+
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+		hdr.version = TRACE_VERSION;
+		hdr.byteord = TRACE_BYTEORD;
+		hdr.opsize = sizeof(traceop_t);
+		hdr.weight = 1;
+		hdr.num_ids = num_ids;
+		hdr.num_ops = num_ops;
+		hdr.ignore_ranges = num_ops > RANGE_CHECK_MAX;
+		fwrite(&hdr, sizeof(hdr), 1, out);
+		fwrite(ops, sizeof(traceop_t), num_ops, out);
+	} else {
+		fprintf(out, "1\n%d\n%ld\n%d\n", num_ids, num_ops,
+				num_ops > RANGE_CHECK_MAX);
+		for (i = 0; i < num_ops; i++) {
+			if (ops[i].type == FREE)
+				fprintf(out, "f %d\n", ops[i].index);
+			else
+				fprintf(out, "%c %d %zu\n", ops[i].type == ALLOC ? 'a' : 'r',
+						ops[i].index, ops[i].size);
+		}
+	}
+	if (fclose(out) != 0)
+		fprintf(stderr, "mtrace: write to %s failed\n", name);
+	else
+		fprintf(stderr, "mtrace: %ld requests on %d ids written to %s\n",
+				num_ops, num_ids, name);
+
+	__libc_free(live.slots);
+	__libc_free(moving.slots);
+	__libc_free(recs);
+	__libc_free(ops);
+	__libc_free(free_ids);
+}
@@ -0,0 +1,100 @@
+/*
+ * perfctr.c - count hardware events while a function runs, using the
+ * Linux perf_event_open system call
+ *
+ * Each event gets a counter of its own (rather than one group), so an
+ * event the CPU does not have only loses that column. Only user-mode
+ * events are counted, which is what an unprivileged process may see.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char *name;
+    unsigned type;
+    unsigned long long config;
+} events[PERF_NEVENTS] = {
+    { "cycles",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instr",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "L1d-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { "LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "dTLB-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int fds[PERF_NEVENTS];
+static int nopen = 0;
+
+/*
+ * perf_init - open a disabled counter for every event we can
+ */
+int perf_init(void)
+{
+    struct perf_event_attr attr;
+    int e;
+
+    nopen = 0;
+    for (e = 0; e < PERF_NEVENTS; e++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[e].type;
+	attr.config = events[e].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[e] >= 0)
+	    nopen++;
+    }
+    return nopen;
+}
+
+const char *perf_name(int e)
+{
+    return events[e].name;
+}
+
+/*
+ * perf_count - count the events during one call of f(argp)
+ */
+int perf_count(perf_test_funct f, void *argp, double counts[PERF_NEVENTS])
+{
+    /* value, time enabled, time running */
+    unsigned long long v[3];
+    int e;
+
+    if (nopen == 0)
+	return 0;
+
+    for (e = 0; e < PERF_NEVENTS; e++) {
+	if (fds[e] >= 0) {
+	    ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+    f(argp);
+    for (e = 0; e < PERF_NEVENTS; e++) {
+	if (fds[e] >= 0)
+	    ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (e = 0; e < PERF_NEVENTS; e++) {
+	counts[e] = -1;
+	if (fds[e] < 0 || read(fds[e], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+	    continue;
+	/* the counter only ran for part of the time if it was multiplexed */
+	counts[e] = (double)v[0] * v[1] / v[2];
+    }
+    return 1;
+}
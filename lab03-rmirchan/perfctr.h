@@ -0,0 +1,33 @@
+/*
+ * perfctr.h - hardware performance counters (Linux perf_event_open)
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* The counted events, in the order perf_count reports them */
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NEVENTS
+};
+
+typedef void (*perf_test_funct)(void *);
+
+/* Open the counters for this process. Returns how many of them the
+   kernel and the CPU allow; 0 means none (e.g. perf_event_paranoid) */
+int perf_init(void);
+
+/* Short name of event e, for table headers */
+const char *perf_name(int e);
+
+/* Run f(argp) once with the counters on, and store each event count
+   in counts[] (scaled up if the kernel had to multiplex the counters),
+   or -1 for an event that could not be counted. Returns 0 if no
+   counter is open */
+int perf_count(perf_test_funct f, void *argp, double counts[PERF_NEVENTS]);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,91 @@
+/*
+ * rep2bin.c - convert a text (.rep) trace into the binary trace format
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ *
+ * The binary file (see tracefmt.h) holds the trace header and its ops
+ * exactly as mdriver stores them, so mdriver can map it instead of
+ * parsing it. Pass the .bin file to mdriver with -f like any trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE 1024
+
+static void die(const char *msg, const char *filename)
+{
+	fprintf(stderr, "rep2bin: %s: %s\n", filename, msg);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *in, *out;
+	tracehdr_t hdr;
+	traceop_t *ops;
+	char type[MAXLINE];
+	int index, size;
+	int max_index = -1;
+	int n = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+		exit(1);
+	}
+	if ((in = fopen(argv[1], "r")) == NULL)
+		die("could not open", argv[1]);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.byteord = TRACE_BYTEORD;
+	hdr.opsize = sizeof(traceop_t);
+	if (fscanf(in, "%d %d %d %d", &hdr.weight, &hdr.num_ids,
+				&hdr.num_ops, &hdr.ignore_ranges) != 4 ||
+			hdr.num_ids < 0 || hdr.num_ops < 0)
+		die("bad trace header", argv[1]);
+
+	if ((ops = calloc(hdr.num_ops ? hdr.num_ops : 1, sizeof(*ops))) == NULL)
+		die("out of memory", argv[1]);
+
+	/* the same request lines read_trace accepts */
+	while (n < hdr.num_ops && fscanf(in, "%s", type) == 1) {
+		switch (type[0]) {
+			case 'a':
+			case 'r':
+				if (fscanf(in, "%d %d", &index, &size) != 2 || index < 0)
+					die("bad alloc/realloc request", argv[1]);
+				ops[n].type = (type[0] == 'a') ? ALLOC : REALLOC;
+				ops[n].size = size;
+				max_index = (index > max_index) ? index : max_index;
+				break;
+			case 'f':
+				if (fscanf(in, "%d", &index) != 1)
+					die("bad free request", argv[1]);
+				ops[n].type = FREE;
+				break;
+			default:
+				die("bogus request type", argv[1]);
+		}
+		ops[n].index = index;
+		n++;
+	}
+	fclose(in);
+	if (n != hdr.num_ops)
+		die("fewer requests than the header says", argv[1]);
+	if (max_index != hdr.num_ids - 1)
+		die("largest block index does not match num_ids", argv[1]);
+
+	if ((out = fopen(argv[2], "w")) == NULL)
+		die("could not create", argv[2]);
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+			fwrite(ops, sizeof(*ops), n, out) != (size_t)n ||
+			fclose(out) != 0)
+		die("write failed", argv[2]);
+
+	free(ops);
+	return 0;
+}
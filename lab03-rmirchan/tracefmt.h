@@ -0,0 +1,45 @@
+#ifndef __TRACEFMT_H_
+#define __TRACEFMT_H_
+
+/*
+ * tracefmt.h - in-memory trace operations and the binary trace format
+ *
+ * A binary trace (.bin, written by rep2bin) is a tracehdr_t followed
+ * directly by num_ops traceop_t records, laid out exactly as mdriver
+ * keeps them in memory. mdriver mmaps the file and points its ops array
+ * at the records, so nothing is parsed when the trace is loaded.
+ *
+ * The format is native: the header records the op size and a byte
+ * order marker, and a file written on a machine with a different
+ * layout is rejected rather than converted.
+ */
+
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+enum { ALLOC, FREE, REALLOC };  /* traceop_t types */
+
+typedef struct {
+	int type;                   /* ALLOC, FREE or REALLOC */
+	int index;                  /* index for free() to use later */
+	size_t size;                /* byte size of alloc/realloc request */
+} traceop_t;
+
+#define TRACE_MAGIC   "MMTRACE"  /* 8 bytes with the terminating 0 */
+#define TRACE_VERSION 1
+#define TRACE_BYTEORD 0x01020304
+
+/* Header of a binary trace; its size keeps the ops 8-byte aligned */
+typedef struct {
+	char magic[8];              /* TRACE_MAGIC */
+	unsigned version;           /* TRACE_VERSION */
+	unsigned byteord;           /* TRACE_BYTEORD as written */
+	unsigned opsize;            /* sizeof(traceop_t) as written */
+	int weight;                 /* same four fields as a .rep header */
+	int num_ids;
+	int num_ops;
+	int ignore_ranges;
+	int pad;
+} tracehdr_t;
+
+#endif /* __TRACEFMT_H_ */
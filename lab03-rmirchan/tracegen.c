@@ -0,0 +1,398 @@
+/*
+ * tracegen.c - generate synthetic malloc lab traces
+ *
+ * Writes a .rep trace (or, with -b, a binary trace for mdriver to map)
+ * from a handful of parameters:
+ *
+ *   - request sizes, drawn uniformly or log-uniformly from [min, max];
+ *   - the alloc:free:realloc mix, as relative weights;
+ *   - object lifetimes, exponential or bimodal, measured in requests;
+ *   - a cap on live payload bytes, which turns allocs into frees when
+ *     the next alloc would go over it.
+ *
+ * Every live object is given a death time when it is allocated and a
+ * free releases the object that is due to die soonest, so lifetimes
+ * decide the order objects go away in and the mix decides how often.
+ * Once the requested number of ops has been made, everything still live
+ * is freed in the same order, so the traces are balanced.
+ *
+ * Block ids are recycled once freed, so num_ids is the most objects
+ * that are ever live at once rather than the number of allocs.
+ *
+ * The output depends only on the parameters and the seed. The header
+ * needs the final id and op counts, so the generator runs twice from
+ * the same seed: once to count and once to write.
+ */
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+/* mdriver's overlap check is linear in the live blocks, so bigger
+   traces are always marked ignore-ranges */
+#define RANGE_CHECK_MAX 100000
+
+/* Generator parameters, set from the command line */
+typedef struct {
+	long ops;                 /* stop making new requests after this many */
+	unsigned long seed;
+	size_t min_size, max_size;
+	int log_sizes;            /* log-uniform instead of uniform sizes */
+	int w_alloc, w_free, w_realloc; /* request mix */
+	double life;              /* mean lifetime in requests */
+	int bimodal;              /* 90% live life/10, 10% live 10*life */
+	size_t peak;              /* most live payload bytes */
+	int ignore_ranges;        /* header flag for mdriver */
+} params_t;
+
+/* One live object */
+typedef struct {
+	long death;               /* request number it is due to be freed at */
+	int id;
+} obj_t;
+
+/* Generator state for one pass */
+typedef struct {
+	const params_t *p;
+	unsigned long rng;
+	FILE *out;                /* NULL on the counting pass */
+	int binary;
+	obj_t *heap;              /* live objects, min-heap on death */
+	int nlive;
+	size_t *sizes;            /* current size of each id */
+	int *free_ids;            /* recycled ids */
+	int nfree_ids;
+	int num_ids;              /* ids handed out so far */
+	int cap;                  /* room in heap, sizes and free_ids */
+	size_t live_bytes;
+	long nops;                /* requests written so far */
+} gen_t;
+
+/*
+ * next_rand - splitmix64, so a seed fully determines the trace
+ */
+static unsigned long next_rand(gen_t *g)
+{
+	unsigned long z = (g->rng += 0x9e3779b97f4a7c15UL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+	return z ^ (z >> 31);
+}
+
+/* uniform double in [0, 1) */
+static double next_unit(gen_t *g)
+{
+	return (next_rand(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t pick_size(gen_t *g)
+{
+	const params_t *p = g->p;
+
+	if (p->log_sizes) {
+		double lo = log((double)p->min_size);
+		double hi = log((double)p->max_size + 1);
+		size_t s = (size_t)exp(lo + (hi - lo) * next_unit(g));
+		return (s > p->max_size) ? p->max_size : s;
+	}
+	return p->min_size + next_rand(g) % (p->max_size - p->min_size + 1);
+}
+
+static long pick_life(gen_t *g)
+{
+	double mean = g->p->life;
+
+	if (g->p->bimodal)
+		mean = (next_unit(g) < 0.9) ? mean / 10 : mean * 10;
+	return 1 + (long)(-mean * log(1.0 - next_unit(g)));
+}
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "tracegen: %s\n", msg);
+	exit(1);
+}
+
+/*
+ * emit - write one request (or only count it on the first pass)
+ */
+static void emit(gen_t *g, int type, int id, size_t size)
+{
+	g->nops++;
+	if (g->out == NULL)
+		return;
+	if (g->binary) {
+		traceop_t op;
+
+		memset(&op, 0, sizeof(op));
+		op.type = type;
+		op.index = id;
+		op.size = size;
+		if (fwrite(&op, sizeof(op), 1, g->out) != 1)
+			die("write failed");
+	} else if (type == FREE) {
+		fprintf(g->out, "f %d\n", id);
+	} else {
+		fprintf(g->out, "%c %d %zu\n", type == ALLOC ? 'a' : 'r', id, size);
+	}
+}
+
+/* Min-heap of live objects ordered by death time */
+static void heap_push(gen_t *g, obj_t o)
+{
+	int i = g->nlive++;
+
+	while (i > 0 && g->heap[(i - 1) / 2].death > o.death) {
+		g->heap[i] = g->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	g->heap[i] = o;
+}
+
+static obj_t heap_pop(gen_t *g)
+{
+	obj_t top = g->heap[0];
+	obj_t last = g->heap[--g->nlive];
+	int i = 0, c;
+
+	while ((c = 2 * i + 1) < g->nlive) {
+		if (c + 1 < g->nlive && g->heap[c + 1].death < g->heap[c].death)
+			c++;
+		if (g->heap[c].death >= last.death)
+			break;
+		g->heap[i] = g->heap[c];
+		i = c;
+	}
+	g->heap[i] = last;
+	return top;
+}
+
+static void gen_alloc(gen_t *g)
+{
+	obj_t o;
+	size_t size = pick_size(g);
+
+	if (g->nfree_ids > 0) {
+		o.id = g->free_ids[--g->nfree_ids];
+	} else {
+		if (g->num_ids == g->cap) {
+			g->cap = g->cap ? 2 * g->cap : 1024;
+			g->heap = realloc(g->heap, g->cap * sizeof(*g->heap));
+			g->sizes = realloc(g->sizes, g->cap * sizeof(*g->sizes));
+			g->free_ids = realloc(g->free_ids, g->cap * sizeof(*g->free_ids));
+			if (!g->heap || !g->sizes || !g->free_ids)
+				die("out of memory");
+		}
+		o.id = g->num_ids++;
+	}
+	o.death = g->nops + pick_life(g);
+	g->sizes[o.id] = size;
+	g->live_bytes += size;
+	heap_push(g, o);
+	emit(g, ALLOC, o.id, size);
+}
+
+static void gen_free(gen_t *g)
+{
+	obj_t o = heap_pop(g);
+
+	g->live_bytes -= g->sizes[o.id];
+	g->free_ids[g->nfree_ids++] = o.id;
+	emit(g, FREE, o.id, 0);
+}
+
+static void gen_realloc(gen_t *g)
+{
+	int id = g->heap[next_rand(g) % g->nlive].id;
+	size_t size = pick_size(g);
+
+	g->live_bytes = g->live_bytes - g->sizes[id] + size;
+	g->sizes[id] = size;
+	emit(g, REALLOC, id, size);
+}
+
+/*
+ * generate - make one pass over the trace, writing it to out if that
+ *     is not NULL, and return the number of ids and requests in it
+ */
+static void generate(const params_t *p, FILE *out, int binary,
+		int *num_ids, long *num_ops)
+{
+	gen_t g;
+	int total = p->w_alloc + p->w_free + p->w_realloc;
+
+	memset(&g, 0, sizeof(g));
+	g.p = p;
+	g.rng = p->seed;
+	g.out = out;
+	g.binary = binary;
+
+	while (g.nops < p->ops) {
+		int w = next_rand(&g) % total;
+
+		if (g.nlive == 0) {
+			gen_alloc(&g);
+		} else if (w >= p->w_alloc && w < p->w_alloc + p->w_free) {
+			gen_free(&g);
+		} else if (g.live_bytes + p->max_size > p->peak) {
+			/* allocs and reallocs that might go over the peak free instead */
+			gen_free(&g);
+		} else if (w < p->w_alloc) {
+			gen_alloc(&g);
+		} else {
+			gen_realloc(&g);
+		}
+	}
+	while (g.nlive > 0)
+		gen_free(&g);
+
+	*num_ids = g.num_ids;
+	*num_ops = g.nops;
+	free(g.heap);
+	free(g.sizes);
+	free(g.free_ids);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: tracegen [-hbi] [options] -o <file>\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-o <file>   Write the trace to <file>.\n");
+	fprintf(stderr, "\t-b          Write a binary trace instead of .rep.\n");
+	fprintf(stderr, "\t-n <n>      Make at least n requests (default 1000000).\n");
+	fprintf(stderr, "\t-s <seed>   PRNG seed (default 1).\n");
+	fprintf(stderr, "\t-z <lo:hi>  Request sizes in bytes (default 8:4096).\n");
+	fprintf(stderr, "\t-d <dist>   Size distribution: uniform or log (default log).\n");
+	fprintf(stderr, "\t-m <a:f:r>  Alloc:free:realloc weights (default 50:45:5).\n");
+	fprintf(stderr, "\t-L <n>      Mean object lifetime in requests (default 1000).\n");
+	fprintf(stderr, "\t-l <dist>   Lifetime distribution: exp or bimodal (default exp).\n");
+	fprintf(stderr, "\t-p <bytes>  Most live payload bytes (default 16777216).\n");
+	fprintf(stderr, "\t-i          Tell mdriver not to check block ranges\n"
+			"\t            (always set above %d requests).\n", RANGE_CHECK_MAX);
+	fprintf(stderr, "\t-h          Print this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+	params_t p;
+	char *outfile = NULL;
+	int binary = 0;
+	int num_ids;
+	long num_ops;
+	long lo, hi;
+	FILE *out;
+	int c;
+
+	p.ops = 1000000;
+	p.seed = 1;
+	p.min_size = 8;
+	p.max_size = 4096;
+	p.log_sizes = 1;
+	p.w_alloc = 50;
+	p.w_free = 45;
+	p.w_realloc = 5;
+	p.life = 1000;
+	p.bimodal = 0;
+	p.peak = 16 << 20;
+	p.ignore_ranges = 0;
+
+	while ((c = getopt(argc, argv, "o:bn:s:z:d:m:L:l:p:ih")) != EOF) {
+		switch (c) {
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'b':
+				binary = 1;
+				break;
+			case 'n':
+				p.ops = atol(optarg);
+				break;
+			case 's':
+				p.seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'z':
+				if (sscanf(optarg, "%ld:%ld", &lo, &hi) != 2 ||
+						lo < 1 || hi < lo || hi > INT_MAX)
+					die("-z wants lo:hi with 1 <= lo <= hi");
+				p.min_size = lo;
+				p.max_size = hi;
+				break;
+			case 'd':
+				p.log_sizes = (strcmp(optarg, "log") == 0);
+				if (!p.log_sizes && strcmp(optarg, "uniform") != 0)
+					die("-d wants uniform or log");
+				break;
+			case 'm':
+				if (sscanf(optarg, "%d:%d:%d", &p.w_alloc, &p.w_free,
+							&p.w_realloc) != 3 || p.w_alloc <= 0 ||
+						p.w_free < 0 || p.w_realloc < 0)
+					die("-m wants a:f:r with a > 0");
+				break;
+			case 'L':
+				p.life = atof(optarg);
+				if (p.life < 1)
+					die("-L wants a lifetime of at least 1");
+				break;
+			case 'l':
+				p.bimodal = (strcmp(optarg, "bimodal") == 0);
+				if (!p.bimodal && strcmp(optarg, "exp") != 0)
+					die("-l wants exp or bimodal");
+				break;
+			case 'p':
+				p.peak = strtoul(optarg, NULL, 0);
+				break;
+			case 'i':
+				p.ignore_ranges = 1;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+			default:
+				usage();
+				exit(1);
+		}
+	}
+	if (outfile == NULL) {
+		usage();
+		exit(1);
+	}
+	if (p.peak < p.max_size)
+		die("-p must be at least the largest request size");
+	if (p.ops > RANGE_CHECK_MAX)
+		p.ignore_ranges = 1;
+
+	/* first pass: count */
+	generate(&p, NULL, binary, &num_ids, &num_ops);
+	if (num_ops > INT_MAX)
+		die("too many requests for one trace");
+
+	/* second pass: write */
+	if ((out = fopen(outfile, "w")) == NULL)
+		die("could not create the output file");
+	if (binary) {
+		tracehdr_t hdr;
+
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+		hdr.version = TRACE_VERSION;
+		hdr.byteord = TRACE_BYTEORD;
+		hdr.opsize = sizeof(traceop_t);
+		hdr.weight = 1;
+		hdr.num_ids = num_ids;
+		hdr.num_ops = num_ops;
+		hdr.ignore_ranges = p.ignore_ranges;
+		if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+			die("write failed");
+	} else {
+		fprintf(out, "1\n%d\n%ld\n%d\n", num_ids, num_ops, p.ignore_ranges);
+	}
+	generate(&p, out, binary, &num_ids, &num_ops);
+	if (fclose(out) != 0)
+		die("write failed");
+
+	return 0;
+}
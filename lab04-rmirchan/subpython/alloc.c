@@ -13,6 +13,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -55,20 +56,108 @@ static unsigned char *freeptr;
 static struct Value **ref_table;
 
 /*!
- * This is the number of references currently in the table.  Valid entries
- * are in the range 0 .. num_refs - 1.
+ * This is the number of reference slots that have ever been handed out.
+ * Valid entries are in the range 0 .. num_refs - 1; some of them may be
+ * unused (NULL) slots waiting on the free-slot stack.
  */
 static int num_refs;
 
 /*! This is the actual size of the ref_table. */
 static int max_refs;
 
+/*!
+ * The free-slot stack: the unused slots below num_refs, which the garbage
+ * collector pushes as it frees them, so that make_reference() can pop one
+ * in O(1) instead of scanning the table for a NULL entry.  It has room for
+ * max_refs entries.
+ */
+static Reference *free_refs;
+
+/*! The number of slots on the free-slot stack. */
+static int num_free_refs;
+
+
+/*!
+ * The pool is split into two generations.  Everything below nursery_start
+ * is tenured: it has survived a collection and is only reclaimed by a full
+ * collection.  Everything from nursery_start up to freeptr is the nursery,
+ * where new values are bump-allocated, and which a minor collection sweeps
+ * on its own.  Survivors of a minor collection are slid down to
+ * nursery_start and become tenured.
+ */
+static unsigned char *nursery_start;
+
+/*!
+ * The number of bytes the nursery may hold before a minor collection is
+ * run.  This is NURSERY_SIZE, or a quarter of the pool for small pools.
+ */
+static int nursery_size;
+
+/*!
+ * The remembered set: tenured list/dict nodes that have been written to
+ * since the last collection, and so may refer to values in the nursery.
+ * These nodes act as extra roots for a minor collection.  A node is only
+ * recorded once (see in_remset), so like the free-slot stack this has room
+ * for max_refs entries.
+ */
+static Reference *remset;
+
+/*! The number of nodes in the remembered set. */
+static int num_remset;
+
+/*! Per-reference flags recording which nodes are in the remembered set. */
+static unsigned char *in_remset;
+
+
+/*!
+ * The mark bitmap: bit (ref % 64) of word (ref / 64) is set when the value
+ * with that reference has been marked.  Keeping the marks off to the side
+ * means marking never writes to the values themselves, and the sweep can
+ * find the dead references a whole word at a time.  Outside of a collection
+ * every bit is clear.  It has room for max_refs bits.
+ */
+static uint64_t *mark_bits;
+
+/*! The number of 64-bit words needed to hold a bit for each of n refs. */
+#define MARK_WORDS(n) (((n) + 63) / 64)
+
+
+/*!
+ * The mark stack: values that have been marked but whose references have
+ * not been followed yet.  Marking drains it in a loop instead of recursing,
+ * so a long list does not need a C stack frame per node.  It grows by
+ * doubling and is kept between collections.
+ */
+static Reference *mark_stack;
+
+/*! The number of values on the mark stack, and its allocated size. */
+static int mark_top, mark_max;
+
+/*!
+ * Values below this address are not marked or followed.  It is the start of
+ * the pool for a full collection, and nursery_start for a minor one.
+ */
+static unsigned char *mark_floor;
+
 
 //// LOCAL HELPER FUNCTIONS ////
 
 
 Reference make_reference();
 
+/*! Returns true if the value with the given reference is marked. */
+static bool is_marked(Reference ref) {
+    return (mark_bits[ref / 64] >> (ref % 64)) & 1;
+}
+
+/*! Marks the value with the given reference. */
+static void set_marked(Reference ref) {
+    mark_bits[ref / 64] |= (uint64_t) 1 << (ref % 64);
+}
+
+static void sweep(unsigned char *start);
+static void collect_nursery(void);
+
 
 //// FUNCTION DEFINITIONS ////
 
@@ -101,12 +190,25 @@ void mm_init(int memory_size) {
 
     freeptr = mem;
 
+    /* Everything starts out in the nursery. */
+    nursery_start = mem;
+    nursery_size = MEMORY_SIZE / 4;
+    if (nursery_size > NURSERY_SIZE)
+        nursery_size = NURSERY_SIZE;
+
     /* Start out with no references in our reference-table. */
     ref_table = NULL;
     num_refs = 0;
     max_refs = 0;
-
-
+    free_refs = NULL;
+    num_free_refs = 0;
+    remset = NULL;
+    num_remset = 0;
+    in_remset = NULL;
+    mark_bits = NULL;
+    mark_stack = NULL;
+    mark_top = 0;
+    mark_max = 0;
 }
 
 
@@ -145,18 +247,24 @@ Value * mm_malloc(ValueType type, int data_size) {
     int requested = sizeof(struct Value) + data_size;
     Value *new_value = NULL;
 
-    // If we don't have space, this might work.
-    if (!has_space_available(requested))
-        collect_garbage();
+    /* If the nursery is full, collect it on its own first.  Only if that
+     * leaves too little room for another nursery do we fall back to a full
+     * collection of the pool.
+     */
+    if (freeptr + requested > nursery_start + nursery_size ||
+            !has_space_available(requested)) {
+        collect_nursery();
+
+        if (!has_space_available(requested) ||
+                !has_space_available(nursery_size))
+            collect_garbage();
+    }
 
     if (has_space_available(requested)) {
 
         /* Initialize the new Value in the bytes beginning at freeptr. */
         new_value = (Value *) freeptr;
 
-        /* All data isn't marked in the beginning */
-        new_value->marked = (int)0;
-
         /* Assign a Reference to it; the Value will know its Reference. */
         make_reference(new_value);
 
@@ -185,12 +293,20 @@ Reference make_reference(Value *value) {
     int i;
     Reference ref;
     Value **new_table;
+    Reference *new_free;
+    Reference *new_remset;
+    unsigned char *new_flags;
+    uint64_t *new_bits;
 
     assert(value != NULL);
 
     /* If we don't have a reference table yet, allocate one. */
     if (ref_table == NULL) {
         ref_table = malloc(sizeof(Value *) * INITIAL_SIZE);
+        free_refs = malloc(sizeof(Reference) * INITIAL_SIZE);
+        remset = malloc(sizeof(Reference) * INITIAL_SIZE);
+        in_remset = calloc(INITIAL_SIZE, 1);
+        mark_bits = calloc(MARK_WORDS(INITIAL_SIZE), sizeof(uint64_t));
         max_refs = INITIAL_SIZE;
 
         // Set all new reference entries to NULL, just to be safe/clean.
@@ -199,17 +315,13 @@ Reference make_reference(Value *value) {
         }
     }
 
-    /* Scan through the reference table to see if we have any unused slots
-     * that we can use for this value.
-     */
-    for (i = 0; i < num_refs; i++) {
-        if (ref_table[i] == NULL) {
-            ref = (Reference) i;  // Probably unnecessary, but clearer.
-            ref_table[i] = value;
-            value->ref = ref;
-            num_refs++;
-            return ref;
-        }
+    /* Reuse an unused slot that the garbage collector freed, if any. */
+    if (num_free_refs > 0) {
+        ref = free_refs[--num_free_refs];
+        assert(ref_table[ref] == NULL);
+        ref_table[ref] = value;
+        value->ref = ref;
+        return ref;
     }
 
     /* If we got here, we don't have any available slots.  Find out if
@@ -217,18 +329,33 @@ Reference make_reference(Value *value) {
      */
 
     if (num_refs == max_refs) {
-        /* Double the size of the reference table. */
+        /* Double the size of the reference table, and of the free-slot
+         * stack and remembered set, which may have to hold every slot.
+         */
         max_refs *= 2;
         new_table = realloc(ref_table, sizeof(Value *) * max_refs);
-        if (new_table == NULL) {
+        new_free = realloc(free_refs, sizeof(Reference) * max_refs);
+        new_remset = realloc(remset, sizeof(Reference) * max_refs);
+        new_flags = realloc(in_remset, max_refs);
+        new_bits = realloc(mark_bits,
+                           sizeof(uint64_t) * MARK_WORDS(max_refs));
+        if (new_table == NULL || new_free == NULL ||
+                new_remset == NULL || new_flags == NULL || new_bits == NULL) {
             error("out of memory");
             exit(1);
         }
         ref_table = new_table;
+        free_refs = new_free;
+        remset = new_remset;
+        in_remset = new_flags;
+        mark_bits = new_bits;
+        memset(mark_bits + MARK_WORDS(num_refs), 0, sizeof(uint64_t) *
+               (MARK_WORDS(max_refs) - MARK_WORDS(num_refs)));
 
         // Set all new reference entries to NULL, just to be safe/clean.
         for (i = num_refs; i < max_refs; i++) {
             ref_table[i] = NULL;
+            in_remset[i] = 0;
         }
     }
 
@@ -275,6 +402,12 @@ int memuse() {
 }
 
 
+/*! Get the size of the memory pool. */
+int memsize() {
+    return MEMORY_SIZE;
+}
+
+
 /*! Print all allocated objects and free regions in the pool. */
 void memdump() {
     unsigned char *curr = mem;
@@ -287,7 +420,7 @@ void memdump() {
 
         fprintf(stdout, "Value 0x%08x; size %d; ref %d; marked %d; ",
             (int) (curr - mem), (int) sizeof(Value) + data_size, 
-                    ref, curr_value->marked);
+                    ref, is_marked(ref));
 
         switch (curr_value->type) {
             case VAL_NONE:
@@ -344,92 +477,127 @@ void memdump() {
 
 
 
-/*
- * mark_mem - given a global variable reference, sets all connected values
- *           to have marked = 1
- */
+//// GARBAGE COLLECTOR ////
 
-void mark_mem(const char *name, Reference ref) {
-    /* Take care of unused argument. */
-    (void)(name);
 
-    /* Get the actual value poimnter */
-    Value * val = deref(ref);
+/*! Returns true if the value lives in the nursery rather than tenured. */
+static bool is_young(Value *val) {
+    return (unsigned char *) val >= nursery_start;
+}
+
 
-    if(val == NULL ) {
-        return;
+/*!
+ * write_barrier - must be called on a list or dict node whenever one of its
+ *           references is overwritten.  A tenured node may now refer to a
+ *           nursery value that nothing else keeps alive, so it is added to
+ *           the remembered set for the next minor collection.
+ */
+void write_barrier(Value *node) {
+    assert(node->type == VAL_LIST_NODE || node->type == VAL_DICT_NODE);
+
+    if (!is_young(node) && !in_remset[node->ref]) {
+        in_remset[node->ref] = 1;
+        remset[num_remset++] = node->ref;
     }
+}
 
-    if (val->type == VAL_LIST_NODE && val->marked == 1) {
-        return;
-    }   
 
+/*! Empties the remembered set. */
+static void clear_remset(void) {
+    while (num_remset > 0)
+        in_remset[remset[--num_remset]] = 0;
+}
 
-    if (val->type == VAL_DICT_NODE) { 
-        /* Convert to DictValue pointer */
-        DictValue * value = (DictValue *)val;
-        /* Set the marked of the value and node to 1 */
-        value->marked = (int)1;
-        value->dict_node.marked = (int)1;
 
-        /* Call mark function on key, value and next references */
-        mark_mem(name, value->dict_node.key);
-        mark_mem(name, value->dict_node.value);
-        mark_mem(name, value->dict_node.next);
+/*!
+ * Marks the value ref refers to and pushes it on the mark stack, unless it
+ * is NULL_REF, already marked, or below mark_floor.  The same check applies
+ * to every type of value, so shared structure is only followed once.
+ */
+static void mark_ref(Reference ref) {
+    Value *val;
+    Reference *new_stack;
 
-        
+    if (ref == NULL_REF || is_marked(ref)) {
+        return;
     }
-    else if (val->type == VAL_LIST_NODE) {
 
+    val = deref(ref);
+    if ((unsigned char *) val < mark_floor) {
+        return;
+    }
 
-        /* Convert to ListValue pointer */
-        ListValue * value = (ListValue *)val;
-        value->marked = (int)1;
-        value->list_node.marked = (int)1;
-
-        mark_mem(name, value->list_node.value);
-
-        mark_mem(name, value->list_node.next);
+    set_marked(ref);
 
-        
-    }
-    else {
-        /* Otherwise, just set marked to 1 */
-        // printf("int marked\n");
-        val->marked = 1;
+    /* Only lists and dicts refer to other values. */
+    if (val->type != VAL_LIST_NODE && val->type != VAL_DICT_NODE) {
+        return;
     }
 
+    if (mark_top == mark_max) {
+        mark_max = mark_max ? mark_max * 2 : INITIAL_SIZE;
+        new_stack = realloc(mark_stack, sizeof(Reference) * mark_max);
+        if (new_stack == NULL) {
+            error("out of memory");
+            exit(1);
+        }
+        mark_stack = new_stack;
+    }
+    mark_stack[mark_top++] = ref;
 }
 
-//// GARBAGE COLLECTOR ////
 
+/*! Marks the values that a list or dict node refers to. */
+static void mark_fields(Value *val) {
+    if (val->type == VAL_DICT_NODE) {
+        DictValue *value = (DictValue *) val;
+        mark_ref(value->dict_node.key);
+        mark_ref(value->dict_node.value);
+        mark_ref(value->dict_node.next);
+    }
+    else if (val->type == VAL_LIST_NODE) {
+        ListValue *value = (ListValue *) val;
+        mark_ref(value->list_node.value);
+        mark_ref(value->list_node.next);
+    }
+}
 
-int collect_garbage(void) {
-    unsigned char *old_freeptr = freeptr;
-    int reclaimed = 0;
 
-    if (!quiet) {
-        fprintf(stderr, "Collecting garbage.\n");
+/*! Follows the references of everything on the mark stack until it is
+ *  empty. */
+static void drain_mark_stack(void) {
+    while (mark_top > 0) {
+        mark_fields(deref(mark_stack[--mark_top]));
     }
+}
 
-    // TODO:  Implement garbage collection.
-    
-
-    /* Mark and sweep algorithm for garbage collection */
 
-    /***** MARK PHASE *****/
-    /* Mark phase that marks all global variables to 1, called from 
-       helper function */
-    foreach_global(mark_mem);
+/*
+ * mark_mem - given a root reference, sets the mark bits of all
+ *           connected values at or above mark_floor.  Nursery values that
+ *           a tenured node refers to are reached through the remembered set
+ *           in a minor collection.
+ */
+static void mark_mem(const char *name, Reference ref) {
+    /* Take care of unused argument. */
+    (void)(name);
 
+    mark_ref(ref);
+    drain_mark_stack();
+}
 
 
-    
-    /***** SWEEP and COMPACT Phase *****/
+/*
+ * sweep - compacts the marked values from start up to freeptr down towards
+ *           start, and frees the references of the unmarked ones.  freeptr
+ *           is left just past the last survivor, and the mark bitmap is
+ *           cleared.
+ */
+static void sweep(unsigned char *start) {
     /* 2 pointers:
         free_block -> points to the start of the free space
                       (the space right after the last block we just compacted)
-                      -starts at the beginning of the heap
+                      -starts at the beginning of the region
                       -every time we add a compacted block, increment free pointer by 
                        that size
         current_ptr -> what traverses the heap looking for
@@ -439,57 +607,119 @@ int collect_garbage(void) {
      */
 
 
-    /* We want both our pointers pointing to the beginning of the heap. */
-    unsigned char * current_ptr = mem;
-    unsigned char * free_block = mem;
+    /* We want both our pointers pointing to the beginning of the region. */
+    unsigned char * current_ptr = start;
+    unsigned char * free_block = start;
+    int w, words = MARK_WORDS(num_refs);
 
     /* Go until the current pointer reaches the 
         end of the stack (the global free_pointer) */
     while (current_ptr < freeptr) {
 
-        /* Get the current block value that we are looking at*/
+        /* Get the current block value that we are looking at, and its
+           size (before the memmove below can overwrite its header) */
         Value * current_block = (Value *)current_ptr;
+        int block_size = current_block->data_size + sizeof(Value);
 
-        if (current_block->marked == 0){
-            /* If the block is unmarked, we need to move the current_block
-               pointer past it */
-            /* Set the reference of the block to null */
-            ref_table[current_block->ref] = NULL;
-            current_ptr += (current_block->data_size + sizeof(Value));
-            
-        }
-
-        else {
+        if (is_marked(current_block->ref)) {
             /* If the block is marked, we want to move it to the 
                last free space (the free_block ptr) */
 
             /* Change the ref_table entry of the current block */
             ref_table[current_block->ref] = (Value *)free_block;
 
-            /* Update the current_block to be unmarked 
-                (for the remaining marks ) */
-            current_block->marked = (int)0; 
-
             /* Move the memory from the current to the free block */
-            memmove(free_block, current_block, 
-                            current_block->data_size + sizeof(Value));
+            memmove(free_block, current_block, block_size);
 
             /* Increment the free_block pointer past the added block */
-            free_block += (current_block->data_size + sizeof(Value));
+            free_block += block_size;
+        }
+
+        /* An unmarked block is just skipped over; its reference is freed
+           below */
+        current_ptr += block_size;
+    }
 
-            /* Increment the current block size */
-            current_ptr += (current_block->data_size + sizeof(Value));
 
+   freeptr = free_block;
+
+    /* Now free the references of the unmarked blocks: walk the zero bits of
+       the bitmap a word at a time.  A fully marked word is skipped outright;
+       otherwise each unmarked slot is found with ctz.  Slots that are
+       already free are NULL, and the ref_table entries of the dead blocks
+       still point into the swept region, which tells them apart from
+       unmarked tenured values in a minor collection. */
+    for (w = 0; w < words; w++) {
+        uint64_t unmarked = ~mark_bits[w];
+
+        while (unmarked != 0) {
+            Reference ref = w * 64 + __builtin_ctzll(unmarked);
+            unmarked &= unmarked - 1;
+
+            if (ref >= num_refs)
+                break;
+
+            if (ref_table[ref] != NULL &&
+                    (unsigned char *) ref_table[ref] >= start) {
+                /* Set the reference of the block to null, and push its
+                   slot on the free-slot stack for make_reference to
+                   reuse */
+                ref_table[ref] = NULL;
+                free_refs[num_free_refs++] = ref;
+            }
         }
+    }
+
+    /* Clear the marks for the next collection. */
+    memset(mark_bits, 0, sizeof(uint64_t) * words);
+}
+
+
+/*
+ * collect_nursery - a minor collection.  Marks the nursery from the roots
+ *           and the remembered set, compacts the survivors onto the end of
+ *           the tenured region and promotes them, leaving an empty nursery.
+ */
+static void collect_nursery(void) {
+    int i;
 
+    mark_floor = nursery_start;
+    foreach_root(mark_mem);
 
+    for (i = 0; i < num_remset; i++) {
+        mark_fields(deref(remset[i]));
+        drain_mark_stack();
     }
+    clear_remset();
 
+    sweep(nursery_start);
+    nursery_start = freeptr;
+}
 
-   freeptr = free_block;
 
-    // END TODO
+int collect_garbage(void) {
+    unsigned char *old_freeptr = freeptr;
+    int reclaimed = 0;
 
+    if (!quiet) {
+        fprintf(stderr, "Collecting garbage.\n");
+    }
+
+    /* Mark and sweep algorithm for garbage collection */
+
+    /***** MARK PHASE *****/
+    /* Mark phase that marks everything reachable from the roots (the
+       global variables and the interpreter's caches), called from
+       helper function */
+    mark_floor = mem;
+    foreach_root(mark_mem);
+
+    /***** SWEEP and COMPACT Phase *****/
+    /* A full collection compacts the whole pool, and everything that
+       survives it is tenured. */
+    sweep(mem);
+    clear_remset();
+    nursery_start = freeptr;
 
     reclaimed = (int) (old_freeptr - freeptr);
 
@@ -517,5 +747,17 @@ int collect_garbage(void) {
 void mm_cleanup(void) {
     free(mem);
     mem = NULL;
+    free(ref_table);
+    ref_table = NULL;
+    free(free_refs);
+    free_refs = NULL;
+    free(remset);
+    remset = NULL;
+    free(in_remset);
+    in_remset = NULL;
+    free(mark_stack);
+    mark_stack = NULL;
+    free(mark_bits);
+    mark_bits = NULL;
 }
 
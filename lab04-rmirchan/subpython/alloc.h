@@ -15,6 +15,12 @@
 
 #include "types.h"
 
+/*!
+ * The largest the nursery gets, in bytes.  New values are allocated in the
+ * nursery, which is collected on its own whenever it fills up.
+ */
+#define NURSERY_SIZE 32768
+
 /* Returns true if an address is within the pool; false otherwise. */
 bool is_pool_address(void *addr);
 
@@ -32,12 +38,18 @@ Value *deref(Reference ref);
 /* Return the amount of used memory. */
 int memuse(void);
 
+/* Return the size of the memory pool. */
+int memsize(void);
+
 /* Print all allocated objects and free regions in the pool. */
 void memdump(void);
 
 /* Runs the garbage collector to reclaim unused space. */
 int collect_garbage(void);
 
+/* Records a store into a list or dict node for the generational collector. */
+void write_barrier(Value *node);
+
 /* Clean up the allocator and memory pool state. */
 void mm_cleanup(void);
 
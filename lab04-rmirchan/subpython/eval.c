@@ -44,6 +44,37 @@ static Reference NONE_REF = NULL_REF;
 static Reference TRUE_REF = NULL_REF;
 static Reference FALSE_REF = NULL_REF;
 
+/* The small integer cache.  eval_init preallocates the integers from
+ * small_int_min to small_int_max, and make_reference_int hands these out
+ * instead of allocating.  The cache takes at most 1/SMALL_INT_SHARE of the
+ * memory pool, so it is filled from 0 up to SMALL_INT_MAX first, where the
+ * loop counters and indexes are, and only then down to SMALL_INT_MIN.  Like
+ * the singletons above, they are roots that are never collected. */
+#define SMALL_INT_MIN (-5)
+#define SMALL_INT_MAX 1024
+#define SMALL_INT_SHARE 16
+
+static Reference small_ints[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+static long int small_int_min = 0;
+static long int small_int_max = -1;
+
+/* The string interning table: an open-addressed hash table, keyed on the
+ * string contents, of the string literals in the program.  Its strings are
+ * roots that are never collected, so they may take at most 1/INTERN_SHARE
+ * of the memory pool; literals past that are made afresh each time, like
+ * any other string.  Empty slots hold NULL_REF. */
+#define INTERN_SHARE 16
+
+static Reference *interned = NULL;
+static int num_interned = 0;
+static int max_interned = 0;
+
+/* The bytes of the pool the small integer cache and the interned strings
+ * take.  Neither is ever collected, so mem() leaves both out and reports
+ * only what the program has allocated beyond them. */
+static int small_int_bytes = 0;
+static int interned_bytes = 0;
+
 
 bool ref_is_none(Reference r) {
     return r == NONE_REF;
@@ -82,7 +113,8 @@ Reference make_reference_bool();
 Reference make_reference_int(long int v);
 Reference make_reference_float(double f);
 Reference make_reference_string(const char *value);
-Reference make_reference_string_concat(const char *v1, const char *v2);
+Reference make_reference_string_interned(const char *value);
+Reference make_reference_string_concat(Reference r1, Reference r2);
 Reference make_reference_list_node(Reference value);
 Reference make_reference_dict_node(Reference key, Reference value);
 
@@ -247,6 +279,7 @@ void list_delete_elem(Reference ref, long int idx) {
 
     /* Remove this element from the list. */
     elem->list_node.next = next->list_node.next;
+    write_barrier((Value *) elem);
 }
 
 
@@ -276,13 +309,13 @@ DictValue *dict_get_entry(Reference ref, Reference key, bool create) {
      */
     DictValue *start = deref_to_dict_value(ref);
     DictValue *entry = start;
-    DictValue *prev;
+    Reference prev;
     assert(start->dict_node.key == NULL_REF);
     assert(start->dict_node.value == NULL_REF);
 
     /* Move past the first entry. */
     entry = deref_to_dict_value(entry->dict_node.next);
-    prev = start;
+    prev = ref;
 
     /* Iterate until we find our key, or until we reach the end of the
      * dictionary's entries. */
@@ -291,7 +324,7 @@ DictValue *dict_get_entry(Reference ref, Reference key, bool create) {
             break;
         }
 
-        prev = entry;
+        prev = entry->ref;
         entry = deref_to_dict_value(entry->dict_node.next);
     }
 
@@ -304,15 +337,18 @@ DictValue *dict_get_entry(Reference ref, Reference key, bool create) {
         else {
             /* The caller wants us to create a new entry.  Tack it onto the
              * end of the dictionary.  Set the key, but we don't know what
-             * value it should have yet.
+             * value it should have yet.  The allocation may move the
+             * previous entry, so it is only dereferenced afterwards.
              */
 
             Reference entry_ref = make_reference_dict_node(key, NULL_REF);
             entry = (DictValue *) deref(entry_ref);
 
-            assert(prev != NULL);
-            assert(prev->dict_node.next == NULL_REF);
-            prev->dict_node.next = entry_ref;
+            DictValue *last = deref_to_dict_value(prev);
+            assert(last != NULL);
+            assert(last->dict_node.next == NULL_REF);
+            last->dict_node.next = entry_ref;
+            write_barrier((Value *) last);
         }
     }
 
@@ -354,6 +390,7 @@ void dict_delete_entry(Reference ref, Reference key) {
 
     /* Otherwise, remove the entry. */
     prev->dict_node.next = entry->dict_node.next;
+    write_barrier((Value *) prev);
 }
 
 
@@ -717,6 +754,21 @@ void eval_init() {
     add_global_variable("None",  NONE_REF = make_reference_none());
     add_global_variable("True",  TRUE_REF = make_reference_bool(true));
     add_global_variable("False", FALSE_REF = make_reference_bool(false));
+
+    /* Preallocate the small integer cache.  The bounds only move past an
+     * integer once it is in the cache, so each one is a root as soon as it
+     * has been allocated. */
+    long int count = memsize() / SMALL_INT_SHARE / sizeof(IntegerValue);
+    for (long int i = 0; i <= SMALL_INT_MAX && count > 0; i++, count--) {
+        small_ints[i - SMALL_INT_MIN] = make_reference_int(i);
+        small_int_max = i;
+    }
+    for (long int i = -1; i >= SMALL_INT_MIN && count > 0; i--, count--) {
+        small_ints[i - SMALL_INT_MIN] = make_reference_int(i);
+        small_int_min = i;
+    }
+    small_int_bytes =
+        (small_int_max - small_int_min + 1) * sizeof(IntegerValue);
 }
 
 /*! Entry point to the evaluation system. */
@@ -744,7 +796,19 @@ EvaluationResult eval_main(Node *node) {
                 NodeStmtAssign *assign = (NodeStmtAssign *) node;
 
                 Reference rref = eval_expr(assign->right);
-                Reference *lref = eval_expr_lval(assign->left, true);
+                Reference *lref;
+
+                /* Storing into a list or dict evaluates the subscript and
+                 * may allocate a new dict entry, so keep the right hand
+                 * side from being collected meanwhile.  eval_expr_lval
+                 * also passes the node to the write barrier. */
+                if (assign->left->type == EXPR_SUBSCRIPT) {
+                    size_t tglob_idx = add_temporary_global(rref);
+                    lref = eval_expr_lval(assign->left, true);
+                    remove_temporary_global(tglob_idx);
+                } else {
+                    lref = eval_expr_lval(assign->left, true);
+                }
 
                 /* Checking for invalid assignments should have been
                  * done in `eval_expr_lval` which will refuse to evalate
@@ -954,11 +1018,15 @@ static Reference eval_builtin_add(Node *l, Node *r) {
 
             if (lv->type == rv->type) {
                 switch (lv->type) {
-                    case VAL_STRING:
-                        result = make_reference_string_concat(
-                                ((StringValue *) lv)->string_value,
-                                ((StringValue *) rv)->string_value);
+                    case VAL_STRING: {
+                        /* The allocation may collect the pool, so hold on
+                         * to the right hand side and concatenate by
+                         * reference rather than through pool pointers. */
+                        size_t rglob_idx = add_temporary_global(rref);
+                        result = make_reference_string_concat(lref, rref);
+                        remove_temporary_global(rglob_idx);
                         break;
+                    }
 
                     /* case VAL_LIST_NODE: */
                     /* case VAL_DICT_NODE: */
@@ -1136,7 +1204,7 @@ static Reference eval_builtin_mem(size_t arity, NodeList *args) {
         error("mem() takes 0 positional arguments but %d were given", arity);
     }
 
-    printf("%d\n", memuse());
+    printf("%d\n", memuse() - small_int_bytes - interned_bytes);
 
     return NONE_REF;
 }
@@ -1291,7 +1359,7 @@ static bool is_hashable(ValueType type) {
 Reference eval_expr(Node *node) {
     switch (node->type) {
         case EXPR_LITERAL_STRING:
-            return make_reference_string(
+            return make_reference_string_interned(
                         ((NodeExprLiteralString *) node)->value);
 
         case EXPR_LITERAL_INTEGER:
@@ -1318,11 +1386,18 @@ Reference eval_expr(Node *node) {
                 for (NodeListEntry *entry = exprs->head; entry;
                         entry = entry->next) {
 
+                    /* A collection while the list is being built may
+                     * tenure its head, so every store goes through the
+                     * write barrier. */
                     Reference next = make_reference_list_node(NONE_REF);
-                    deref_to_list_value(tail)->list_node.next = next;
+                    ListValue *lv = deref_to_list_value(tail);
+                    lv->list_node.next = next;
+                    write_barrier((Value *) lv);
 
                     Reference elem = eval_expr(entry->node);
-                    deref_to_list_value(next)->list_node.value = elem;
+                    lv = deref_to_list_value(next);
+                    lv->list_node.value = elem;
+                    write_barrier((Value *) lv);
 
                     tail = next;
                 }
@@ -1360,17 +1435,25 @@ Reference eval_expr(Node *node) {
                         (NodeExprLiteralPair *) entry->node;
 
                     Reference next = make_reference_dict_node(NONE_REF, NONE_REF);
-                    deref_to_dict_value(tail)->dict_node.next = next;
+                    DictValue *elem = deref_to_dict_value(tail);
+                    elem->dict_node.next = next;
+                    write_barrier((Value *) elem);
 
+                    /* Store the value right away, so that it is reachable
+                     * while the key is evaluated. */
                     Reference valueref = eval_expr(pair->value);
+                    elem = deref_to_dict_value(next);
+                    elem->dict_node.value = valueref;
+                    write_barrier((Value *) elem);
+
                     Reference keyref = eval_expr(pair->key);
                     if (!is_hashable(deref(keyref)->type)) {
                         error("dictionary keys must be hashable");
                     }
 
-                    DictValue *elem = deref_to_dict_value(next);
+                    elem = deref_to_dict_value(next);
                     elem->dict_node.key = keyref;
-                    elem->dict_node.value = valueref;
+                    write_barrier((Value *) elem);
 
                     tail = next;
                 }
@@ -1456,6 +1539,7 @@ Reference *eval_expr_lval(Node *node, bool create) {
                 case VAL_LIST_NODE: {
                     ListValue *elem = list_get_elem(objref,
                             coerce_ref_to_int(keyref));
+                    write_barrier((Value *) elem);
                     result = &(elem->list_node.value);
                     break;
                 }
@@ -1464,6 +1548,7 @@ Reference *eval_expr_lval(Node *node, bool create) {
                     /* Find entry with key or, if applicable, create it. */
                     DictValue *lhs_dict = dict_get_entry(objref,
                             keyref, create);
+                    write_barrier((Value *) lhs_dict);
                     result = &(lhs_dict->dict_node.value);
                     break;
                 }
@@ -1636,6 +1721,28 @@ int foreach_global(void (*f)(const char *name, Reference Ref)) {
     return num_vars;
 }
 
+/*!
+ * Calls f on every root of the garbage collector: the globals, followed by
+ * the cached small integers and the interned strings, which are passed with
+ * a NULL name.
+ */
+int foreach_root(void (*f)(const char *name, Reference ref)) {
+    int roots = foreach_global(f);
+
+    for (long int i = small_int_min; i <= small_int_max; i++, roots++) {
+        f(NULL, small_ints[i - SMALL_INT_MIN]);
+    }
+
+    for (int i = 0; i < max_interned; i++) {
+        if (interned[i] != NULL_REF) {
+            f(NULL, interned[i]);
+            roots++;
+        }
+    }
+
+    return roots;
+}
+
 void print_global_helper(const char *name, Reference ref) {
     fprintf(stdout, "%s = ref %d; value ", name, ref);
     ref_print_ext(stdout, ref, true, MAX_DEPTH);
@@ -1668,8 +1775,13 @@ Reference make_reference_bool() {
     return v->ref;
 }
 
-/*! Assigns a long int to a new reference in the ref_table. */
+/*! Assigns a long int to a new reference in the ref_table, or returns the
+ *  cached reference for a small integer. */
 Reference make_reference_int(long int i) {
+    if (i >= small_int_min && i <= small_int_max) {
+        return small_ints[i - SMALL_INT_MIN];
+    }
+
     IntegerValue *iv = (IntegerValue *) mm_malloc(VAL_INTEGER, /* ignored */ 0);
     iv->integer_value = i;
     return iv->ref;
@@ -1683,6 +1795,51 @@ Reference make_reference_float(double f) {
     return fv->ref;
 }
 
+/*! Hashes a string for the interning table (djb2). */
+static unsigned int hash_string(const char *str) {
+    unsigned int hash = 5381;
+    while (*str) {
+        hash = hash * 33 + (unsigned char) *str++;
+    }
+    return hash;
+}
+
+/*! Returns the interning table slot for the string, which is either the
+ *  slot holding it or the empty slot where it belongs. */
+static int intern_slot(const char *value) {
+    int i = hash_string(value) & (max_interned - 1);
+
+    while (interned[i] != NULL_REF &&
+            strcmp(((StringValue *) deref(interned[i]))->string_value,
+                   value) != 0) {
+        i = (i + 1) & (max_interned - 1);
+    }
+    return i;
+}
+
+/*! Doubles the interning table, rehashing the strings already in it. */
+static void intern_grow() {
+    Reference *old = interned;
+    int old_max = max_interned;
+
+    max_interned = old_max ? old_max * 2 : INITIAL_SIZE;
+    interned = malloc(sizeof(Reference) * max_interned);
+    if (interned == NULL) {
+        error("%s", "Allocation failed!");
+    }
+    for (int i = 0; i < max_interned; i++) {
+        interned[i] = NULL_REF;
+    }
+
+    for (int i = 0; i < old_max; i++) {
+        if (old[i] != NULL_REF) {
+            StringValue *sv = (StringValue *) deref(old[i]);
+            interned[intern_slot(sv->string_value)] = old[i];
+        }
+    }
+    free(old);
+}
+
 /*! Assigns a string to a new reference in the ref_table. */
 Reference make_reference_string(const char *value) {
     StringValue *sv = (StringValue *) mm_malloc(VAL_STRING, strlen(value) + 1);
@@ -1690,12 +1847,42 @@ Reference make_reference_string(const char *value) {
     return sv->ref;
 }
 
-/*! Assigns a concatenated string to a new referecne in the ref_table. */
-Reference make_reference_string_concat(const char *v1, const char *v2) {
-    int len1 = strlen(v1), len2 = strlen(v2);
+/*! Returns the interned reference for a string literal, creating it the
+ *  first time the literal is evaluated, or a new uninterned string once the
+ *  interned strings have used up their share of the pool.  Strings are
+ *  never modified, so sharing them is safe. */
+Reference make_reference_string_interned(const char *value) {
+    /* Keep the table at most half full. */
+    if (2 * (num_interned + 1) > max_interned) {
+        intern_grow();
+    }
+
+    int slot = intern_slot(value);
+    if (interned[slot] != NULL_REF) {
+        return interned[slot];
+    }
+
+    int bytes = sizeof(Value) + strlen(value) + 1;
+    if (interned_bytes + bytes > memsize() / INTERN_SHARE) {
+        return make_reference_string(value);
+    }
+
+    StringValue *sv = (StringValue *) mm_malloc(VAL_STRING, strlen(value) + 1);
+    strcpy(sv->string_value, value);
+
+    interned[slot] = sv->ref;
+    num_interned++;
+    interned_bytes += bytes;
+    return sv->ref;
+}
+
+/*! Assigns a concatenated string to a new referecne in the ref_table.
+ *  Both strings must be rooted, since allocating may move them. */
+Reference make_reference_string_concat(Reference r1, Reference r2) {
+    int len1 = deref(r1)->data_size - 1, len2 = deref(r2)->data_size - 1;
     StringValue *sv = (StringValue *) mm_malloc(VAL_STRING, len1 + len2 + 1);
-    strcpy(sv->string_value, v1);
-    strcpy(sv->string_value + len1, v2);
+    strcpy(sv->string_value, ((StringValue *) deref(r1))->string_value);
+    strcpy(sv->string_value + len1, ((StringValue *) deref(r2))->string_value);
     return sv->ref;
 }
 
@@ -17,6 +17,7 @@ bool ref_is_true(Reference r);
 bool ref_is_false(Reference r);
 
 int foreach_global(void (*f)(const char *name, Reference ref));
+int foreach_root(void (*f)(const char *name, Reference ref));
 void print_globals(void);
 
 void clear_temporary_globals(void);
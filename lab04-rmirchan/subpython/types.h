@@ -34,23 +34,16 @@ typedef enum ValueType {
 
 /*! This is a single element of a linked list. */
 typedef struct ListNode {
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
-
     /*! The value at this index of the list. */
     Reference value;
 
     /*! The next node in the list, or NULL_REF if this is the last node. */
     Reference next;
-
 } ListNode;
 
 
 /*! This is a single entry in a dictionary. */
 typedef struct DictNode {
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
-
     /*! The key for this dictionary entry. */
     Reference key;
 
@@ -59,7 +52,6 @@ typedef struct DictNode {
 
     /*! The next key/value pair in the dictionary. */
     Reference next;
-
 } DictNode;
 
 
@@ -96,9 +88,6 @@ typedef struct Value {
      * it is.
      */
     int data_size;
-
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
 } Value;
 
 /*!
@@ -119,9 +108,6 @@ typedef struct IntegerValue {
     /*! This specifies what kind of value is actually represented. */
     ValueType type;
 
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
-
     /*!
      * This is the size of the data in the value.  For fixed-size types, this
      * is as expected - e.g. integers are 4 bytes, and so forth.  For strings,
@@ -132,7 +118,6 @@ typedef struct IntegerValue {
 
     /*! The integer value this IntegerValue represents. */
     int integer_value;
-
 } IntegerValue;
 
 /*!
@@ -163,9 +148,6 @@ typedef struct FloatValue {
 
     /*! The float value this FloatValue represents. */
     double float_value;
-
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
 } FloatValue;
 
 
@@ -195,9 +177,6 @@ typedef struct StringValue {
      */
     int data_size;
 
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
-
     /*!
      * The string value this StringValue represents.  We use the undimensioned
      * array syntax so that the string data can immediately follow the Value
@@ -237,8 +216,6 @@ typedef struct ListValue {
 
     /*! The details of the list element stored in this ListValue. */
     ListNode list_node;
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
 } ListValue;
 
 
@@ -270,9 +247,6 @@ typedef struct DictValue {
 
     /*! The details of the dictonary entry stored in this DictValue. */
     DictNode dict_node;
-
-    /* Tell us if the memory is linked to a global variable - 0 or 1. */ 
-    int marked;
 } DictValue;
 
 